@@ -0,0 +1,108 @@
+// arena.h 🐧
+//
+// Entry storage for ColorDir.
+// The names of a directory listing live back to back in a chunked arena, and the entries
+// themselves are small fixed-size records that only point into it. Both are reset when the
+// next directory is scanned, keeping their memory, so listing a large tree allocates about
+// as much as its widest directory needs instead of a few heap blocks for every entry.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstring>
+#include <memory>
+#include <string_view>
+#include <vector>
+#include "hdir.h"
+
+// Monotonic storage for file names
+// Chunks are never moved or freed before the arena itself, so views stay valid until reset()
+// The first chunk is small, since most directories are; every further one is twice as big
+class NameArena {
+public:
+    explicit NameArena(size_t chunkSize = 4 * 1024) : chunkSize(chunkSize) {}
+
+    NameArena(const NameArena&) = delete;
+    NameArena& operator=(const NameArena&) = delete;
+
+    // Copy a name into the arena (NUL-terminated) and return a view of the copy
+    std::string_view store(const char* data, size_t length) {
+        if (length + 1 > available) nextChunk(length + 1);
+        char* copy = cursor;
+        std::memcpy(copy, data, length);
+        copy[length] = '\0';
+        cursor += length + 1;
+        available -= length + 1;
+        return std::string_view(copy, length);
+    }
+
+    // Forget all names but keep the chunks for the next directory
+    void reset() {
+        current = 0;
+        cursor = chunks.empty() ? nullptr : chunks[0].data.get();
+        available = chunks.empty() ? 0 : chunks[0].size;
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    // Move on to the next chunk that can hold at least size bytes, allocating one if needed
+    void nextChunk(size_t size) {
+        size_t next = cursor ? current + 1 : 0;
+        while (next < chunks.size() && chunks[next].size < size) ++next;
+        if (next >= chunks.size()) {
+            size_t length = std::max(chunkSize << std::min<size_t>(chunks.size(), 8), size);
+            chunks.push_back({std::unique_ptr<char[]>(new char[length]), length});
+            next = chunks.size() - 1;
+        }
+        current = next;
+        cursor = chunks[next].data.get();
+        available = chunks[next].size;
+    }
+
+    size_t chunkSize;               // Size of the first chunk
+    std::vector<Chunk> chunks;      // All chunks allocated so far
+    size_t current = 0;             // Chunk being filled
+    char* cursor = nullptr;         // Next free byte in the current chunk
+    size_t available = 0;           // Free bytes left in the current chunk
+};
+
+// Read-only view of consecutive entries, handed to the renderers instead of a copy
+struct EntryRange {
+    const DirEntry* first = nullptr;
+    size_t count = 0;
+
+    const DirEntry* begin() const { return first; }
+    const DirEntry* end() const { return first + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const DirEntry& operator[](size_t i) const { return first[i]; }
+};
+
+// The entries of one directory and the storage of their names
+// After sorting, the subdirectories come first, followed by the files
+struct DirectoryListing {
+    NameArena names;               // Names of all entries
+    std::vector<DirEntry> entries; // Subdirectories, then files
+    size_t directoryCount = 0;     // Number of subdirectories at the front of entries
+
+    // Empty the listing for the next directory, keeping its memory
+    void reset() {
+        names.reset();
+        entries.clear();
+        directoryCount = 0;
+    }
+
+    EntryRange all() const { return {entries.data(), entries.size()}; }
+    EntryRange directories() const { return {entries.data(), directoryCount}; }
+    EntryRange files() const { return {entries.data() + directoryCount, entries.size() - directoryCount}; }
+};
+
+#endif // ARENA_H
@@ -0,0 +1,452 @@
+// bench.h 🐧
+//
+// Built-in benchmark for ColorDir (--bench DIR).
+// Generates reproducible synthetic trees below DIR (created once, reused by later runs) and
+// measures them with the listing output sent to /dev/null:
+//
+//   flat    one directory with 1,000,000 files
+//   deep    a chain of nested directories, as deep as PATH_MAX allows (up to 10,000)
+//   mixed   a wide and deep tree of about 200,000 files
+//
+// Every tree is first taken apart into the phases of a listing (scan, stat, categorize,
+// sort, render, summary), each timed on its own, and then listed end to end the way the
+// program normally runs. Syscalls and heap allocations are reported per entry (perf.h), so
+// a regression in any phase shows up as a number. --bench-scale N divides all tree sizes.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <climits>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "hdir.h"
+#include "arena.h"
+#include "sort.h"
+#include "perf.h"
+
+// Implemented in c.cpp
+void statDirEntry(int dirFd, DirEntry& entry, const ListOptions& options);
+std::uintmax_t printEntry(const DirEntry& entry, bool showTotalSize);
+void listDirectoryContents(const fs::path& path, const ListOptions& options, Totals& totals);
+
+// Small deterministic random number generator (SplitMix64), so every run builds the same tree
+class BenchRandom {
+public:
+    explicit BenchRandom(std::uint64_t seed) : state(seed) {}
+
+    std::uint64_t next() {
+        std::uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+        return z ^ (z >> 31);
+    }
+
+    // Uniform value in [0, bound)
+    std::uint64_t below(std::uint64_t bound) { return next() % bound; }
+
+private:
+    std::uint64_t state;
+};
+
+// Writes the synthetic trees
+class BenchTreeGenerator {
+public:
+    explicit BenchTreeGenerator(std::uint64_t seed) : random(seed) {}
+
+    // One directory holding count files
+    bool flat(const std::string& path, size_t count) {
+        int dirFd = makeDirectory(AT_FDCWD, path.c_str());
+        if (dirFd < 0) return false;
+        for (size_t i = 0; i < count; ++i) makeFile(dirFd, i);
+        ::close(dirFd);
+        return true;
+    }
+
+    // A chain of depth nested directories with two files on every level
+    bool deep(const std::string& path, size_t depth) {
+        int dirFd = makeDirectory(AT_FDCWD, path.c_str());
+        if (dirFd < 0) return false;
+        size_t serial = 0;
+        for (size_t level = 0; level < depth; ++level) {
+            makeFile(dirFd, serial++);
+            makeFile(dirFd, serial++);
+            int childFd = makeDirectory(dirFd, "d");
+            ::close(dirFd);
+            if (childFd < 0) return false;
+            dirFd = childFd;
+        }
+        ::close(dirFd);
+        return true;
+    }
+
+    // A tree of random shape: up to 30 files and 6 subdirectories per directory, 7 levels
+    // deep at most, filled breadth-first until fileBudget files exist
+    bool mixed(const std::string& path, size_t fileBudget) {
+        struct Pending {
+            std::string path;
+            int depth;
+        };
+        std::deque<Pending> queue;
+        queue.push_back({path, 0});
+        size_t serial = 0;
+
+        while (!queue.empty() && serial < fileBudget) {
+            Pending directory = std::move(queue.front());
+            queue.pop_front();
+            int dirFd = makeDirectory(AT_FDCWD, directory.path.c_str());
+            if (dirFd < 0) return false;
+
+            size_t files = random.below(31);
+            for (size_t i = 0; i < files && serial < fileBudget; ++i) makeFile(dirFd, serial++);
+            size_t subdirectories = directory.depth < 6 ? 1 + random.below(6) : 0;
+            for (size_t i = 0; i < subdirectories; ++i) {
+                queue.push_back({directory.path + "/" + randomStem() + "_d" + std::to_string(serial + i), directory.depth + 1});
+            }
+            ::close(dirFd);
+        }
+        return true;
+    }
+
+    // A realistic file name with an extension: stem, serial number and extension
+    std::string fileName(size_t serial) {
+        std::string name;
+        if (random.below(100) < 3) name += '.'; // Some hidden files
+        name += randomStem();
+        name += '_';
+        name += std::to_string(serial);
+        name += pickExtension();
+        return name;
+    }
+
+private:
+    // Create a directory (if needed) and open it
+    static int makeDirectory(int parentFd, const char* name) {
+        mkdirat(parentFd, name, 0755);
+        return openat(parentFd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    }
+
+    // Create one file with a realistic name and (sparse) size
+    void makeFile(int dirFd, size_t serial) {
+        std::string name = fileName(serial);
+        mode_t mode = (random.below(100) < 2) ? 0755 : 0644;
+        int fd = openat(dirFd, name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, mode);
+        if (fd < 0) return;
+        unsigned bits = static_cast<unsigned>(random.below(25));
+        off_t size = static_cast<off_t>(random.below(std::uint64_t(1) << bits));
+        if (size > 0) ftruncate(fd, size);
+        ::close(fd);
+    }
+
+    // Random lowercase stem, occasionally capitalized
+    std::string randomStem() {
+        static const char letters[] = "abcdefghijklmnopqrstuvwxyz0123456789";
+        size_t length = 3 + random.below(10);
+        std::string stem;
+        for (size_t i = 0; i < length; ++i) stem += letters[random.below(sizeof(letters) - 1)];
+        if (random.below(10) == 0) stem[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(stem[0])));
+        return stem;
+    }
+
+    // Extension drawn from a fixed mix typical for source trees and home directories
+    const char* pickExtension() {
+        struct Weighted {
+            const char* extension;
+            unsigned weight;
+        };
+        static const Weighted mix[] = {
+            {".c", 6}, {".h", 6}, {".cpp", 5}, {".hpp", 2}, {".py", 4}, {".js", 4}, {".sh", 1}, {".html", 2},
+            {".css", 1}, {".txt", 6}, {".md", 3}, {".json", 3}, {".xml", 2}, {".log", 3}, {".jpg", 5},
+            {".png", 5}, {".gif", 1}, {".mp4", 2}, {".mkv", 1}, {".zip", 2}, {".tar.gz", 2}, {".o", 6},
+            {".so", 1}, {"", 6},
+        };
+        unsigned total = 0;
+        for (const auto& item : mix) total += item.weight;
+        unsigned pick = static_cast<unsigned>(random.below(total));
+        for (const auto& item : mix) {
+            if (pick < item.weight) return item.extension;
+            pick -= item.weight;
+        }
+        return "";
+    }
+
+    BenchRandom random;
+};
+
+// Sends fd 1 to /dev/null for its lifetime
+class NullStdout {
+public:
+    NullStdout() {
+        output().flush();
+        std::cout.flush();
+        saved = dup(STDOUT_FILENO);
+        int null = ::open("/dev/null", O_WRONLY | O_CLOEXEC);
+        if (null >= 0) {
+            dup2(null, STDOUT_FILENO);
+            ::close(null);
+        }
+    }
+
+    ~NullStdout() {
+        output().flush();
+        if (saved >= 0) {
+            dup2(saved, STDOUT_FILENO);
+            ::close(saved);
+        }
+    }
+
+private:
+    int saved = -1;
+};
+
+// One directory of a tree taken apart by the phase measurements
+struct BenchDirectory {
+    std::string path;
+    std::vector<DirEntry> entries;
+};
+
+// Measures one phase: wall time plus the events counted in between
+class BenchPhase {
+public:
+    BenchPhase() : before(takePerfSnapshot()), start(std::chrono::steady_clock::now()) {}
+
+    // Print one row of the report
+    void report(const std::string& name, size_t entries) const {
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        PerfSnapshot events = takePerfSnapshot() - before;
+        double perEntry = entries ? 1.0 / entries : 0.0;
+        std::uint64_t syscalls = events[PerfEvent::Open] + events[PerfEvent::Getdents] +
+                                 events[PerfEvent::Statx] + events[PerfEvent::Write];
+
+        std::cout << "  " << std::left << std::setw(14) << name << std::right << std::fixed
+                  << std::setw(13) << std::setprecision(1) << milliseconds
+                  << std::setw(13) << std::setprecision(1) << milliseconds * 1e6 * perEntry
+                  << std::setw(13) << std::setprecision(3) << syscalls * perEntry
+                  << std::setw(13) << std::setprecision(3) << events[PerfEvent::Allocation] * perEntry
+                  << "   (open " << events[PerfEvent::Open] << ", getdents " << events[PerfEvent::Getdents]
+                  << ", statx " << events[PerfEvent::Statx] << ", write " << events[PerfEvent::Write] << ")"
+                  << std::endl;
+    }
+
+private:
+    PerfSnapshot before;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Time the phases of a listing one by one over a whole tree, returns its number of entries
+size_t benchPhases(const std::string& root, const ListOptions& options) {
+    NameArena names(1 << 20);
+    std::vector<BenchDirectory> directories;
+    size_t entryCount = 0;
+
+    std::cout << "  " << std::left << std::setw(14) << "phase" << std::right << std::setw(13) << "ms"
+              << std::setw(13) << "ns/entry" << std::setw(13) << "sys/entry" << std::setw(13) << "alloc/entry"
+              << std::endl;
+
+    {
+        // Scan: read every directory, breadth-first, following d_type only
+        BenchPhase phase;
+        DirectoryScanner scanner;
+        directories.push_back({root, {}});
+        for (size_t i = 0; i < directories.size(); ++i) {
+            if (!scanner.open(directories[i].path.c_str())) continue;
+            ScanEntry raw;
+            while (scanner.next(raw)) {
+                DirEntry entry;
+                entry.name = names.store(raw.name, raw.nameLength);
+                entry.isDirectory = (raw.type == DT_DIR);
+                entry.isRegularFile = (raw.type == DT_REG);
+                entry.isHidden = (raw.name[0] == '.');
+                directories[i].entries.push_back(entry);
+                if (entry.isDirectory) directories.push_back({directories[i].path + "/" + raw.name, {}});
+            }
+            scanner.close();
+            entryCount += directories[i].entries.size();
+        }
+        phase.report("scan", entryCount);
+    }
+    {
+        BenchPhase phase;
+        for (auto& directory : directories) {
+            countEvent(PerfEvent::Open);
+            int dirFd = ::open(directory.path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd < 0) continue;
+            for (auto& entry : directory.entries) statDirEntry(dirFd, entry, options);
+            ::close(dirFd);
+        }
+        phase.report("stat", entryCount);
+    }
+    {
+        BenchPhase phase;
+        for (auto& directory : directories) {
+            for (auto& entry : directory.entries) {
+                entry.type = entry.isDirectory ? FileType::Other : categorizeFile(entry);
+            }
+        }
+        phase.report("categorize", entryCount);
+    }
+    {
+        BenchPhase phase;
+        for (auto& directory : directories) sortEntries(directory.entries);
+        phase.report("sort", entryCount);
+    }
+    Totals totals;
+    {
+        BenchPhase phase;
+        {
+            NullStdout discard;
+            for (const auto& directory : directories) {
+                for (const auto& entry : directory.entries) {
+                    printEntry(entry, false);
+                    if (entry.isDirectory) totals.dirs++;
+                    else totals.files++;
+                    totals.size += entry.size;
+                }
+            }
+        }
+        phase.report("render", entryCount);
+    }
+    {
+        BenchPhase phase;
+        {
+            NullStdout discard;
+            displaySummary(totals.files, totals.dirs, totals.size);
+        }
+        phase.report("summary", entryCount);
+    }
+    return entryCount;
+}
+
+// Time complete listings of a tree with the given extra flags (best of three runs)
+// Costs are given per entry of the whole tree, also for listings that print fewer entries
+void benchListing(const std::string& root, const std::string& label, ListOptions options, size_t treeEntries) {
+    double best = 0;
+    PerfSnapshot bestEvents;
+    Totals totals;
+    for (int run = 0; run < 3; ++run) {
+        totals = Totals();
+        PerfSnapshot before = takePerfSnapshot();
+        auto start = std::chrono::steady_clock::now();
+        {
+            NullStdout discard;
+            listDirectoryContents(root, options, totals);
+            displaySummary(totals.files, totals.dirs, totals.size);
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0 || milliseconds < best) {
+            best = milliseconds;
+            bestEvents = takePerfSnapshot() - before;
+        }
+    }
+
+    size_t entries = static_cast<size_t>(totals.files) + static_cast<size_t>(totals.dirs);
+    double perEntry = treeEntries ? 1.0 / treeEntries : 0.0;
+    std::uint64_t syscalls = bestEvents[PerfEvent::Open] + bestEvents[PerfEvent::Getdents] +
+                             bestEvents[PerfEvent::Statx] + bestEvents[PerfEvent::Write];
+    std::cout << "  " << std::left << std::setw(14) << label << std::right << std::fixed
+              << std::setw(13) << std::setprecision(1) << best
+              << std::setw(13) << std::setprecision(1) << best * 1e6 * perEntry
+              << std::setw(13) << std::setprecision(3) << syscalls * perEntry
+              << std::setw(13) << std::setprecision(3) << bestEvents[PerfEvent::Allocation] * perEntry
+              << "   (" << entries << " entries listed, " << bestEvents[PerfEvent::WrittenBytes] << " bytes written)"
+              << std::endl;
+}
+
+// Run the whole benchmark in directory (created if needed) and print the report
+int runBenchmarks(const std::string& directory, unsigned scale, const ListOptions& baseOptions) {
+    // Sizes of the trees; the deep chain is kept short enough for its paths to fit PATH_MAX
+    size_t flatFiles = 1000000 / scale;
+    size_t mixedFiles = 200000 / scale;
+    size_t maxDepth = (PATH_MAX - 256 - directory.size()) / 2;
+    size_t deepLevels = std::min<size_t>(10000 / scale, maxDepth);
+
+    std::ostringstream spec;
+    spec << "colordir-bench v1 flat=" << flatFiles << " deep=" << deepLevels << " mixed=" << mixedFiles << "\n";
+
+    // Reuse the trees of an earlier run with the same sizes; never write into anything else
+    std::string markerPath = directory + "/.bench-tree";
+    std::ifstream marker(markerPath);
+    std::string existing((std::istreambuf_iterator<char>(marker)), std::istreambuf_iterator<char>());
+    if (existing.empty()) {
+        std::error_code error;
+        fs::create_directories(directory, error);
+        if (!fs::is_empty(directory, error) || error) {
+            std::cerr << "Error: " << directory << " is not empty and holds no benchmark trees" << std::endl;
+            return 1;
+        }
+        std::cout << "Generating benchmark trees in " << directory << " ..." << std::endl;
+        BenchTreeGenerator generator(20250501);
+        if (!generator.flat(directory + "/flat", flatFiles) || !generator.deep(directory + "/deep", deepLevels) ||
+            !generator.mixed(directory + "/mixed", mixedFiles)) {
+            std::cerr << "Error: could not create the benchmark trees in " << directory << std::endl;
+            return 1;
+        }
+        std::ofstream(markerPath) << spec.str();
+    } else if (existing != spec.str()) {
+        std::cerr << "Error: " << directory << " holds benchmark trees of another size; remove it first" << std::endl;
+        return 1;
+    }
+
+    ListOptions options = baseOptions;
+    options.index = nullptr;
+    output().setLineFlush(false);
+    setPerfCounting(true);
+
+    struct Listing {
+        const char* label;
+        bool recursive;
+        bool showTotalSize;
+        bool forceList;
+    };
+    struct Tree {
+        const char* name;
+        std::vector<Listing> listings;
+    };
+    const Tree trees[] = {
+        {"flat", {{"c", false, false, false}, {"c -l", false, false, true}}},
+        {"deep", {{"c -r", true, false, false}}},
+        {"mixed", {{"c -r", true, false, false}, {"c -r -l", true, false, true}, {"c -t", false, true, false}}},
+    };
+
+    std::cout << "ColorDir benchmark: " << directory << " (scale 1/" << scale << ", " << options.jobs
+              << " threads)" << std::endl;
+    for (const auto& tree : trees) {
+        std::string root = directory + "/" + tree.name;
+        std::cout << std::endl << tree.name << std::endl;
+
+        // Warm the dentry and inode caches so every measurement sees the same state
+        {
+            Totals ignored;
+            ListOptions warmUp = options;
+            warmUp.recursive = true;
+            NullStdout discard;
+            listDirectoryContents(root, warmUp, ignored);
+        }
+
+        size_t treeEntries = benchPhases(root, options);
+        for (const auto& listing : tree.listings) {
+            ListOptions runOptions = options;
+            runOptions.recursive = listing.recursive;
+            runOptions.showTotalSize = listing.showTotalSize;
+            runOptions.forceList = listing.forceList;
+            benchListing(root, listing.label, runOptions, treeEntries);
+        }
+    }
+
+    setPerfCounting(false);
+    return 0;
+}
+
+#endif // BENCH_H
@@ -16,96 +16,281 @@
 //   - Pattern matching with wildcards (*, ?)
 //
 // Usage:
-//   c [flags] [directory] [pattern]
+//   c [flags] [directory...] [pattern...]
 //   Flags:
 //     -r, --recursive   Recursive listing
 //     -t, --total       Display total size of directories
 //     -l, --list        Force detailed list view
 //     -w, --wide        Force multi-column view
 //     -p, --pause       Pause after each screen of output
+//     -j, --jobs N      Number of threads used by recursive listing and -t
+//         --stream      Print entries as they are read (unsorted, constant memory)
+//         --index FILE  Keep a persistent index to speed up repeated -t / -r scans
+//         --max-depth N Descend at most N levels below the directory with -r
+//         --top N       Show only the N largest files and directories of the whole tree
+//         --sniff       Categorize files without a known extension by their first bytes
+//         --disk-usage  Count allocated space instead of file sizes, hard links once
+//         --batch FILE  Also list the directories named in FILE, one per line (-: stdin)
+//         --watch       Keep the listing on screen and update it as the directory changes
+//         --sort KEY    Sort by type (default), name, size, mtime, ext or none
+//         --head N      Show at most the first N entries of every directory
+//     -x, --one-file-system  Do not descend into other file systems with -r
+//         --json        One JSON object per entry, for other programs
+//     -0, --null        NUL-separated full paths, like find -print0
+//         --stats       Report time per phase, system calls and peak memory use
+//         --bench DIR   Run the built-in benchmark on synthetic trees in DIR
+//         --bench-scale N  Divide the size of the benchmark trees by N
+//         --bench-micro Time the functions every entry goes through (ns/op, allocations/op)
+//         --check       Run the self-checks (no allocations while rendering, random input)
 //     -h, --help        Display help information
 
 #include "hdir.h"
-#include <unordered_set> // Unique to c.cpp
+#include "pool.h"
+#include "sort.h"
+#include "index.h"
+#include "arena.h"
+#include "pager.h"
+#include "record.h"
+#include "bench.h"
+#include "micro.h"
+#include "stats.h"
+#include "render.h"
+#include "width.h"
+#include "meta.h"
+#include "sniff.h"
+#include "inodes.h"
+#include "queue.h"
+#include "top.h"
+#include "watch.h"
+#include <string_view> // Unique to c.cpp
+#include <unordered_map>
+#include <unordered_set>
+#include <fstream>
 
 // Retrieve file permissions as a string (e.g., "rwxr-xr-x")
-std::string getPermissions(const fs::path& path) {
-    struct stat info;
-    if (stat(path.c_str(), &info) != 0) {
-        return "?????????"; // Return placeholder if stat fails
-    }
-
-    std::string permissions;
-    permissions += (S_ISDIR(info.st_mode)) ? 'd' : '-';
-    permissions += (info.st_mode & S_IRUSR) ? 'r' : '-';
-    permissions += (info.st_mode & S_IWUSR) ? 'w' : '-';
-    permissions += (info.st_mode & S_IXUSR) ? 'x' : '-';
-    permissions += (info.st_mode & S_IRGRP) ? 'r' : '-';
-    permissions += (info.st_mode & S_IWGRP) ? 'w' : '-';
-    permissions += (info.st_mode & S_IXGRP) ? 'x' : '-';
-    permissions += (info.st_mode & S_IROTH) ? 'r' : '-';
-    permissions += (info.st_mode & S_IWOTH) ? 'w' : '-';
-    permissions += (info.st_mode & S_IXOTH) ? 'x' : '-';
+// The mode comes from the entry's statx record, so no extra metadata call is made here
+std::string getPermissions(const DirEntry& entry) {
+    if (!entry.hasStat) {
+        return "?????????"; // Return placeholder if stat failed
+    }
+
+    // Filled in place: ten characters stay in the string's own buffer, nothing is allocated
+    static constexpr mode_t bits[] = {S_IRUSR, S_IWUSR, S_IXUSR, S_IRGRP, S_IWGRP, S_IXGRP, S_IROTH, S_IWOTH, S_IXOTH};
+    mode_t mode = entry.mode;
+    std::string permissions(10, '-');
+    if (S_ISDIR(mode)) permissions[0] = 'd';
+    for (size_t i = 0; i < 9; ++i) {
+        if (mode & bits[i]) permissions[i + 1] = "rwx"[i % 3];
+    }
 
     return permissions;
 }
 
-// Categorize a file based on its extension or attributes
-FileType categorizeFile(const fs::directory_entry& entry) {
-    // Define common programming file extensions
-    static const std::unordered_set<std::string> programmingExtensions = {
-        ".cpp", ".h", ".py", ".java", ".cs", ".js", ".php", ".hs", ".rs", ".clj", ".sh", ".pl", ".lua",
-        ".erl", ".ex", ".exs", ".scala", ".d", ".go", ".nim", ".lisp", ".cl", ".f90", ".f95", ".vhdl", ".verilog", 
-        ".coffee", ".racket", ".dart", ".tcl", ".hlsl"
-    };
+// Known file extensions (lowercase) and the category they belong to
+// Multi-dot suffixes like ".tar.gz" are tried before their last component. Every suffix
+// may appear only once; ".sh" is a programming file (it used to be listed as text too).
+struct ExtensionRule {
+    std::string_view suffix;
+    FileType type;
+};
 
-    // Define common text file extensions
-    static const std::unordered_set<std::string> textExtensions = {
-        ".txt", ".md", ".rtf", ".log", ".ini", ".conf", ".config", ".nfo", ".readme", 
-        ".html", ".htm", ".bak", ".asc", ".diff", ".lst", ".srt", ".mdown", ".text", 
-        ".out", ".memo", ".patch", ".logfile", ".po", ".dat", ".env", ".sh", ".doc"
-    };
+constexpr ExtensionRule extensionRules[] = {
+    // Common programming file extensions
+    {".cpp", FileType::Programming}, {".h", FileType::Programming}, {".py", FileType::Programming},
+    {".java", FileType::Programming}, {".cs", FileType::Programming}, {".js", FileType::Programming},
+    {".php", FileType::Programming}, {".hs", FileType::Programming}, {".rs", FileType::Programming},
+    {".clj", FileType::Programming}, {".sh", FileType::Programming}, {".pl", FileType::Programming},
+    {".lua", FileType::Programming}, {".erl", FileType::Programming}, {".ex", FileType::Programming},
+    {".exs", FileType::Programming}, {".scala", FileType::Programming}, {".d", FileType::Programming},
+    {".go", FileType::Programming}, {".nim", FileType::Programming}, {".lisp", FileType::Programming},
+    {".cl", FileType::Programming}, {".f90", FileType::Programming}, {".f95", FileType::Programming},
+    {".vhdl", FileType::Programming}, {".verilog", FileType::Programming}, {".coffee", FileType::Programming},
+    {".racket", FileType::Programming}, {".dart", FileType::Programming}, {".tcl", FileType::Programming},
+    {".hlsl", FileType::Programming},
 
-    // Define common and less common video file extensions
-    static const std::unordered_set<std::string> videoExtensions = {
-        // Common video formats
-        ".mp4", ".mkv", ".avi", ".mov", ".wmv", 
-        ".flv", ".webm", ".mpeg", ".mpg", ".m4v", 
-        ".3gp", ".ogv", ".vob", ".ts", ".m2ts", 
-        // Less common but explicitly video-related formats
-        ".divx", ".rm", ".rmvb", ".asf", ".swf", 
-        ".mxf", ".hevc", ".avchd", ".mts", ".ogm", 
-        ".amv", ".drc", ".yuv", ".h264", ".h265"
-    };
+    // Common text file extensions
+    {".txt", FileType::Text}, {".md", FileType::Text}, {".rtf", FileType::Text}, {".log", FileType::Text},
+    {".ini", FileType::Text}, {".conf", FileType::Text}, {".config", FileType::Text}, {".nfo", FileType::Text},
+    {".readme", FileType::Text}, {".html", FileType::Text}, {".htm", FileType::Text}, {".bak", FileType::Text},
+    {".asc", FileType::Text}, {".diff", FileType::Text}, {".lst", FileType::Text}, {".srt", FileType::Text},
+    {".mdown", FileType::Text}, {".text", FileType::Text}, {".out", FileType::Text}, {".memo", FileType::Text},
+    {".patch", FileType::Text}, {".logfile", FileType::Text}, {".po", FileType::Text}, {".dat", FileType::Text},
+    {".env", FileType::Text}, {".doc", FileType::Text},
 
-    // Define common picture file extensions
-    static const std::unordered_set<std::string> pictureExtensions = {
-        ".jpg", ".jpeg", ".png", ".gif", ".bmp", ".tiff", ".tif", ".webp", 
-        ".svg", ".ico", ".raw", ".xpm", ".ppm", ".pgm", ".pbm", ".heic", ".heif"
-    };
+    // Common and less common video file extensions
+    {".mp4", FileType::Video}, {".mkv", FileType::Video}, {".avi", FileType::Video}, {".mov", FileType::Video},
+    {".wmv", FileType::Video}, {".flv", FileType::Video}, {".webm", FileType::Video}, {".mpeg", FileType::Video},
+    {".mpg", FileType::Video}, {".m4v", FileType::Video}, {".3gp", FileType::Video}, {".ogv", FileType::Video},
+    {".vob", FileType::Video}, {".ts", FileType::Video}, {".m2ts", FileType::Video}, {".divx", FileType::Video},
+    {".rm", FileType::Video}, {".rmvb", FileType::Video}, {".asf", FileType::Video}, {".swf", FileType::Video},
+    {".mxf", FileType::Video}, {".hevc", FileType::Video}, {".avchd", FileType::Video}, {".mts", FileType::Video},
+    {".ogm", FileType::Video}, {".amv", FileType::Video}, {".drc", FileType::Video}, {".yuv", FileType::Video},
+    {".h264", FileType::Video}, {".h265", FileType::Video},
 
-    // Define common compressed file extensions
-    static const std::unordered_set<std::string> compressedExtensions = {
-        ".zip", ".tar", ".gz", ".bz2", ".xz", ".7z", ".rar", ".zst", ".lz4", 
-        ".tar.gz", ".tar.bz2", ".tar.xz", ".tgz", ".tbz2", ".txz", ".tar.zst", 
-        ".tzst", ".tar.lz4", ".tlz4", ".jar", ".war", ".ear", ".cab", ".deb", 
-        ".rpm", ".apk", ".dmg", ".iso", ".img", ".appimage"
-    };
+    // Common picture file extensions
+    {".jpg", FileType::Picture}, {".jpeg", FileType::Picture}, {".png", FileType::Picture},
+    {".gif", FileType::Picture}, {".bmp", FileType::Picture}, {".tiff", FileType::Picture},
+    {".tif", FileType::Picture}, {".webp", FileType::Picture}, {".svg", FileType::Picture},
+    {".ico", FileType::Picture}, {".raw", FileType::Picture}, {".xpm", FileType::Picture},
+    {".ppm", FileType::Picture}, {".pgm", FileType::Picture}, {".pbm", FileType::Picture},
+    {".heic", FileType::Picture}, {".heif", FileType::Picture},
+
+    // Common compressed file extensions
+    {".zip", FileType::Compressed}, {".tar", FileType::Compressed}, {".gz", FileType::Compressed},
+    {".bz2", FileType::Compressed}, {".xz", FileType::Compressed}, {".7z", FileType::Compressed},
+    {".rar", FileType::Compressed}, {".zst", FileType::Compressed}, {".lz4", FileType::Compressed},
+    {".tar.gz", FileType::Compressed}, {".tar.bz2", FileType::Compressed}, {".tar.xz", FileType::Compressed},
+    {".tgz", FileType::Compressed}, {".tbz2", FileType::Compressed}, {".txz", FileType::Compressed},
+    {".tar.zst", FileType::Compressed}, {".tzst", FileType::Compressed}, {".tar.lz4", FileType::Compressed},
+    {".tlz4", FileType::Compressed}, {".jar", FileType::Compressed}, {".war", FileType::Compressed},
+    {".ear", FileType::Compressed}, {".cab", FileType::Compressed}, {".deb", FileType::Compressed},
+    {".rpm", FileType::Compressed}, {".apk", FileType::Compressed}, {".dmg", FileType::Compressed},
+    {".iso", FileType::Compressed}, {".img", FileType::Compressed}, {".appimage", FileType::Compressed}
+};
+
+constexpr size_t extensionRuleCount = sizeof(extensionRules) / sizeof(extensionRules[0]);
+constexpr size_t maxSuffixLength = 16; // Longest suffix the classifier looks at
+
+// Seeded FNV-1a hash with a final mix, usable at compile time
+constexpr std::uint32_t hashSuffix(std::string_view text, std::uint32_t seed) {
+    std::uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (char c : text) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+// Perfect hash table over extensionRules, built at compile time ("hash and displace")
+// A first hash picks a bucket; each bucket stores the seed of a second hash that sends all
+// of its suffixes to distinct slots, so a lookup is two hashes and one string compare
+struct ExtensionTable {
+    static constexpr size_t bucketCount = 64;
+    static constexpr size_t slotCount = 256;
+    std::uint32_t bucketSeed[bucketCount] = {};
+    std::int16_t slotRule[slotCount] = {};  // Index into extensionRules, -1 for an empty slot
+};
+
+// Check the rule list at compile time: unique, lowercase suffixes that fit the lookup buffer
+constexpr bool extensionRulesValid() {
+    for (size_t i = 0; i < extensionRuleCount; ++i) {
+        const std::string_view suffix = extensionRules[i].suffix;
+        if (suffix.size() < 2 || suffix.size() > maxSuffixLength || suffix[0] != '.') return false;
+        for (char c : suffix) {
+            if (c >= 'A' && c <= 'Z') return false;
+        }
+        for (size_t j = i + 1; j < extensionRuleCount; ++j) {
+            if (extensionRules[j].suffix == suffix) return false;
+        }
+    }
+    return true;
+}
+static_assert(extensionRulesValid(), "extension rules must be unique lowercase suffixes");
+
+constexpr ExtensionTable buildExtensionTable() {
+    ExtensionTable table;
+    for (auto& slot : table.slotRule) slot = -1;
+
+    // Group the rules by first-level bucket
+    size_t bucketSize[ExtensionTable::bucketCount] = {};
+    size_t members[ExtensionTable::bucketCount][extensionRuleCount] = {};
+    for (size_t i = 0; i < extensionRuleCount; ++i) {
+        size_t bucket = hashSuffix(extensionRules[i].suffix, 0) % ExtensionTable::bucketCount;
+        members[bucket][bucketSize[bucket]++] = i;
+    }
+
+    // Place the largest buckets first, while the table is still empty
+    size_t order[ExtensionTable::bucketCount] = {};
+    for (size_t i = 0; i < ExtensionTable::bucketCount; ++i) order[i] = i;
+    for (size_t i = 1; i < ExtensionTable::bucketCount; ++i) {
+        for (size_t j = i; j > 0 && bucketSize[order[j]] > bucketSize[order[j - 1]]; --j) {
+            size_t swapped = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = swapped;
+        }
+    }
+
+    for (size_t b = 0; b < ExtensionTable::bucketCount; ++b) {
+        size_t bucket = order[b];
+        if (bucketSize[bucket] == 0) break;
+
+        // Try seeds until every suffix of the bucket lands in its own free slot
+        for (std::uint32_t seed = 1;; ++seed) {
+            size_t slots[extensionRuleCount] = {};
+            bool fits = true;
+            for (size_t k = 0; k < bucketSize[bucket] && fits; ++k) {
+                slots[k] = hashSuffix(extensionRules[members[bucket][k]].suffix, seed) % ExtensionTable::slotCount;
+                if (table.slotRule[slots[k]] != -1) fits = false;
+                for (size_t m = 0; m < k; ++m) {
+                    if (slots[m] == slots[k]) fits = false;
+                }
+            }
+            if (!fits) continue;
+
+            table.bucketSeed[bucket] = seed;
+            for (size_t k = 0; k < bucketSize[bucket]; ++k) {
+                table.slotRule[slots[k]] = static_cast<std::int16_t>(members[bucket][k]);
+            }
+            break;
+        }
+    }
+    return table;
+}
+
+constexpr ExtensionTable extensionTable = buildExtensionTable();
+
+// Look up a lowercase suffix such as ".tar.gz" in the perfect hash table
+bool lookupExtension(std::string_view suffix, FileType& type) {
+    std::uint32_t seed = extensionTable.bucketSeed[hashSuffix(suffix, 0) % ExtensionTable::bucketCount];
+    int rule = extensionTable.slotRule[hashSuffix(suffix, seed) % ExtensionTable::slotCount];
+    if (rule < 0 || extensionRules[rule].suffix != suffix) return false;
+    type = extensionRules[rule].type;
+    return true;
+}
+
+// Categorize a file name by its extension, trying a two-part suffix (".tar.gz") first
+// A dot at the start of the name marks a hidden file, not an extension (like path::extension)
+bool classifyExtension(const char* name, size_t length, FileType& type) {
+    const char* last = nullptr;
+    const char* previous = nullptr;
+    for (const char* p = name + length; p-- > name + 1;) {
+        if (*p != '.') continue;
+        if (!last) {
+            last = p;
+        } else {
+            previous = p;
+            break;
+        }
+    }
+
+    for (const char* start : {previous, last}) {
+        if (!start) continue;
+        size_t suffixLength = static_cast<size_t>(name + length - start);
+        if (suffixLength > maxSuffixLength) continue;
+
+        char folded[maxSuffixLength];
+        for (size_t i = 0; i < suffixLength; ++i) {
+            folded[i] = static_cast<char>(foldCase(static_cast<unsigned char>(start[i])));
+        }
+        if (lookupExtension(std::string_view(folded, suffixLength), type)) return true;
+    }
+    return false;
+}
+
+// Categorize a file based on its extension or attributes
+// Called for every entry, so it has no PhaseScope of its own: the callers charge whole
+// directories to Phase::Categorize (see sortListing)
+FileType categorizeFile(const DirEntry& entry) {
+    if (entry.isRegularFile) {
+        FileType type;
+        if (classifyExtension(entry.name.data(), entry.name.size(), type)) return type;
+        if (entry.content != FileType::Other) return entry.content; // --sniff
 
-    // Get file extension and convert to lowercase
-    std::string extension = entry.path().extension().string();
-    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
-
-    if (entry.is_regular_file()) {
-        if (programmingExtensions.count(extension)) return FileType::Programming;
-        if (textExtensions.count(extension)) return FileType::Text;
-        if (videoExtensions.count(extension)) return FileType::Video;
-        if (pictureExtensions.count(extension)) return FileType::Picture;
-        if (compressedExtensions.count(extension)) return FileType::Compressed;
-        
         // Check if the file is executable
-        auto perms = entry.status().permissions();
-        if ((perms & fs::perms::owner_exec) != fs::perms::none) {
+        if (entry.mode & S_IXUSR) {
             return FileType::Executable;
         }
     }
@@ -114,19 +299,9 @@ FileType categorizeFile(const fs::directory_entry& entry) {
 }
 
 // Get the appropriate color for a file type or directory
-std::string getColor(FileType type, bool isDirectory = false) {
-    if (isDirectory) return "\033[1;34m"; // Blue for directories
-
-    switch (type) {
-        case FileType::Programming: return "\033[0;36m";  // Cyan
-        case FileType::Text: return "\033[0;32m";         // Green
-        case FileType::Video: return "\033[0;35m";        // Magenta
-        case FileType::Picture: return "\033[0;33m";      // Yellow
-        case FileType::Compressed: return "\033[1;31m";   // Red
-        case FileType::Hidden: return "\033[1;30m";       // Dark Gray
-        case FileType::Executable: return "\033[1;36m";   // Bright Cyan
-        default: return "\033[0m";                        // Default (white)
-    }
+std::string_view getColor(FileType type, bool isDirectory) {
+    if (!colorOutput) return {};
+    return styleColor(isDirectory ? fileTypeCount : static_cast<size_t>(type), false);
 }
 
 // Convert a filesystem time to a time_t object
@@ -136,208 +311,1795 @@ time_t to_time_t(const fs::file_time_type& ftime) {
     return std::chrono::system_clock::to_time_t(systemTime);
 }
 
-// Calculate the total size of a directory (recursively)
-std::uintmax_t calculateDirectorySize(const fs::path& path) {
-    std::uintmax_t totalSize = 0;
-    for (const auto& entry : fs::recursive_directory_iterator(path, fs::directory_options::skip_permission_denied)) {
-        if (entry.is_regular_file()) {
-            totalSize += entry.file_size();
+// Helper function to convert a string to lowercase
+std::string toLower(const std::string& str) {
+    std::string lowerStr = str;
+    std::transform(lowerStr.begin(), lowerStr.end(), lowerStr.begin(), ::tolower);
+    return lowerStr;
+}
+
+// True when -w (without -l) guarantees that the multi-column view is used
+bool wideViewForced(const ListOptions& options) {
+    return options.forceWide && !options.forceList;
+}
+
+// True when every entry needs all of its metadata, whatever the view: records written to
+// the --index must serve any later run, and --json prints the mode and mtime of everything
+bool needsFullStat(const ListOptions& options) {
+    return options.index || options.format == OutputFormat::Json;
+}
+
+// statx fields a file needs for the active flags
+// Type, mode and size are always used (categorizing, permissions, summary); the mtime only
+// appears in the list view, so it is skipped when -w forces the multi-column view (unless
+// the entries are sorted by it)
+unsigned int fileStatMask(const ListOptions& options) {
+    unsigned int mask = STATX_TYPE | STATX_MODE | STATX_SIZE;
+    if (!wideViewForced(options) || needsFullStat(options) || options.sortOrder == SortOrder::Mtime) mask |= STATX_MTIME;
+    if (options.sniff) mask |= STATX_INO | STATX_MTIME; // The key of the sniff cache
+    if (options.diskUsage) mask |= STATX_BLOCKS | STATX_NLINK | STATX_INO;
+    return mask;
+}
+
+// statx fields a directory needs: only its mode, for the permission column of the list view,
+// and its mtime for --sort=mtime
+unsigned int directoryStatMask(const ListOptions& options) {
+    if (needsFullStat(options)) return STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME;
+    unsigned int mask = wideViewForced(options) ? 0 : STATX_TYPE | STATX_MODE;
+    if (options.sortOrder == SortOrder::Mtime) mask |= STATX_TYPE | STATX_MTIME;
+    return mask;
+}
+
+// statx fields an entry needs, judged by its d_type
+unsigned int entryStatMask(const DirEntry& entry, const ListOptions& options) {
+    return entry.isDirectory ? directoryStatMask(options) : fileStatMask(options);
+}
+
+// --disk-usage: the space a file takes on disk (less than its size when it is sparse)
+std::uintmax_t allocatedBytes(const struct statx& info) {
+    return (info.stx_mask & STATX_BLOCKS) ? info.stx_blocks * 512 : info.stx_size;
+}
+
+// --disk-usage: true for a file with more than one hard link, which must only be counted once
+bool hasHardLinks(const struct statx& info) {
+    return (info.stx_mask & (STATX_NLINK | STATX_INO)) == (STATX_NLINK | STATX_INO) && info.stx_nlink > 1;
+}
+
+std::uint64_t fileDevice(const struct statx& info) {
+    return makedev(info.stx_dev_major, info.stx_dev_minor);
+}
+
+// --disk-usage: false for a hard link whose file was counted through another link already
+// (inodes.h); a file with a single link is always counted
+// The first link looked up is charged, so this is for entries listed in a fixed order (one
+// directory at a time), or where only the sum of all entries is shown (-r). The parallel
+// walk of -t and --top picks its links itself, see SizeAggregator::settleLinks.
+bool firstLink(const struct statx& info) {
+    return !hasHardLinks(info) || InodeSet::instance().insert(fileDevice(info), info.stx_ino);
+}
+
+// Copy the result of a statx into an entry
+// With --watch entries come and go, so hard links are not tracked there
+void applyStat(DirEntry& entry, const struct statx& info, const ListOptions& options) {
+    entry.hasStat = true;
+    entry.isDirectory = S_ISDIR(info.stx_mode);
+    entry.isRegularFile = S_ISREG(info.stx_mode);
+    entry.mode = info.stx_mode;
+    entry.size = (entry.isRegularFile && (info.stx_mask & STATX_SIZE)) ? info.stx_size : 0;
+    entry.mtime = (info.stx_mask & STATX_MTIME) ? info.stx_mtime.tv_sec : 0;
+    if (options.diskUsage && entry.isRegularFile) {
+        entry.size = allocatedBytes(info);
+        entry.sharedLink = !options.watch && !firstLink(info);
+    }
+}
+
+// True for a file --sniff has to look into: a regular file with content whose extension
+// doesn't tell what it is
+bool needsSniff(const DirEntry& entry, const ListOptions& options) {
+    FileType type;
+    return options.sniff && entry.isRegularFile && entry.size > 0 &&
+           !classifyExtension(entry.name.data(), entry.name.size(), type);
+}
+
+// The sniff request for an entry; without a key (no statx at hand) the result is not cached
+SniffRequest makeSniffRequest(const DirEntry& entry, std::uint32_t tag, const SniffKey& key = SniffKey()) {
+    SniffRequest request;
+    request.name = entry.name.data();
+    request.size = entry.size;
+    request.key = key;
+    request.tag = tag;
+    return request;
+}
+
+// Sniff a single entry of dirFd (sniff.h), info is the statx it was filled from
+void sniffEntry(int dirFd, DirEntry& entry, const struct statx& info, const ListOptions& options) {
+    if (!needsSniff(entry, options)) return;
+    SniffRequest request = makeSniffRequest(entry, 0, sniffKey(info));
+    sniffFiles(dirFd, &request, 1);
+    entry.content = request.type;
+}
+
+// Fetch the metadata of an entry whose name and d_type are already filled in
+// (a single lookup, charged to the phase of the caller; batches are charged to Phase::Stat)
+void statDirEntry(int dirFd, DirEntry& entry, const ListOptions& options) {
+    unsigned int mask = entryStatMask(entry, options);
+    struct statx info;
+    if (mask != 0 && statEntry(dirFd, entry.name.data(), mask, info)) {
+        applyStat(entry, info, options);
+        sniffEntry(dirFd, entry, info, options);
+    }
+}
+
+// Sniff the collected requests of entries (tagged with their index) and apply the results
+void sniffDirEntries(int dirFd, DirEntry* entries, std::vector<SniffRequest>& requests) {
+    sniffFiles(dirFd, requests.data(), requests.size());
+    for (const SniffRequest& request : requests) entries[request.tag].content = request.type;
+    requests.clear();
+}
+
+// Fetch the metadata of entries[0..count) of one directory, many lookups at a time (meta.h)
+// With --sniff, the files that need it are sniffed afterwards as one batch too
+void statDirEntries(int dirFd, DirEntry* entries, size_t count, const ListOptions& options) {
+    static thread_local StatBatch batch;
+    static thread_local std::vector<SniffRequest> sniffing;
+    auto runBatch = [&] {
+        batch.run(dirFd);
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!batch[i].ok) continue;
+            DirEntry& entry = entries[batch.tag(i)];
+            applyStat(entry, batch[i].info, options);
+            if (needsSniff(entry, options)) sniffing.push_back(makeSniffRequest(entry, batch.tag(i), sniffKey(batch[i].info)));
         }
+        batch.clear();
+    };
+    for (size_t i = 0; i < count; ++i) {
+        unsigned int mask = entryStatMask(entries[i], options);
+        if (mask == 0) continue;
+        batch.add(entries[i].name.data(), entries[i].name.size(), mask, true, static_cast<std::uint32_t>(i));
+        if (batch.full()) runBatch();
     }
-    return totalSize;
+    if (batch.size() > 0) runBatch();
+    if (!sniffing.empty()) sniffDirEntries(dirFd, entries, sniffing);
 }
 
-// Print a single file or directory entry with details
-std::uintmax_t printEntry(const fs::directory_entry& entry, bool showTotalSize) {
-    bool isDirectory = entry.is_directory();
-    FileType type = isDirectory ? FileType::Other : categorizeFile(entry);
+// Start a DirEntry from a raw scanner entry: its name (copied into the arena of the
+// listing) and what d_type tells about it
+DirEntry makeNamedEntry(const ScanEntry& raw, NameArena& names) {
+    DirEntry entry;
+    entry.name = names.store(raw.name, raw.nameLength);
+    entry.isDirectory = (raw.type == DT_DIR);
+    entry.isRegularFile = (raw.type == DT_REG);
+    return entry;
+}
+
+// Compute the hidden flag and file type of an entry whose metadata is complete
+// This happens once, so sorting and rendering never have to derive them again
+void finishEntry(DirEntry& entry) {
+    entry.isHidden = (entry.name.front() == '.');
+    entry.type = entry.isDirectory ? FileType::Other : categorizeFile(entry);
+}
 
-    // Check if the file or directory is hidden
-    bool isHidden = (entry.path().filename().string()[0] == '.');
+// Build a DirEntry from a raw scanner entry
+// Directories are classified from d_type; every entry gets at most one statx relative to
+// the open directory, asking only for the fields the active flags use (see fileStatMask).
+// Symlinks and DT_UNKNOWN always need one to learn their real type.
+// (scanDirectory does the same for a whole directory, with batched lookups)
+DirEntry makeEntry(int dirFd, const ScanEntry& raw, NameArena& names, const ListOptions& options) {
+    DirEntry entry = makeNamedEntry(raw, names);
+    statDirEntry(dirFd, entry, options);
+    finishEntry(entry);
+    return entry;
+}
 
-    // Assign emojis based on file type or folder status
-    std::string emoji;
-    if (isDirectory) {
-        emoji = "📂 "; // Folder emoji
-    } else {
-        switch (type) {
-            case FileType::Programming: emoji = "💻 "; break;
-            case FileType::Text: emoji = "📜 "; break;
-            case FileType::Video: emoji = "🎬 "; break;
-            case FileType::Picture: emoji = "🖼️ "; break;
-            case FileType::Executable: emoji = "⚙️ "; break;
-            case FileType::Compressed: emoji = "🎁 "; break;
-            default: emoji = "📄 "; break; // Other/Unknown files
+// Bottom-up directory size aggregation for -t
+// Every directory below the listed ones is scanned exactly once, on the worker pool. A node
+// stays open until its own files and all of its subdirectories are counted, then its total
+// is added to its parent. The top-level totals end up in the size field of each DirEntry,
+// where both the summary and printEntry read them.
+// With --disk-usage, a file with several hard links is not counted while the tree is walked,
+// since the threads see its links in a different order on every run. Each link is offered to
+// a LinkOwners table instead (inodes.h), which keeps the one with the smallest rank (a hash of
+// its path). Once the walk is done, the file is charged to that link, and the directories that
+// hold such links get their totals (and --top its candidates) only then, see settleLinks. So
+// the result is the same on any number of threads.
+class SizeAggregator {
+public:
+    // With diskUsage, files count with their allocated blocks, and hard-linked ones only once
+    explicit SizeAggregator(WorkStealingPool& pool, DirectoryIndex* index = nullptr, bool diskUsage = false)
+        : pool(pool), index(index), diskUsage(diskUsage) {
+        if (diskUsage) fileMask |= STATX_BLOCKS | STATX_NLINK | STATX_INO;
+    }
+
+    // --top: also keep the limit largest files (of those matching pattern) and directories
+    void collectTop(size_t limit, const PatternMatcher& pattern) {
+        top.assign(pool.size(), TopSizes(limit));
+        topPattern = &pattern;
+        fileMask |= STATX_MODE; // The mode tells executables apart
+    }
+
+    // Several directories are listed and may overlap (-t with one inside another): remember the
+    // totals of the directories that any of them lists, so a shared subtree is measured once
+    // The listed directories, and the parents passed to run(), must be canonical paths.
+    void shareTotals(const std::vector<std::string>& listed) {
+        listedPaths.insert(listed.begin(), listed.end());
+    }
+
+    // Fill in the total size of count directories inside parent
+    void run(const fs::path& parent, DirEntry* directories, size_t count) {
+        std::vector<SizeNode> roots(count);
+        std::vector<bool> known(count);
+        for (size_t i = 0; i < count; ++i) {
+            SizeNode* root = &roots[i];
+            root->path = (parent / directories[i].name).string();
+            if (!listedPaths.empty() && knownTotal(root->path, directories[i].size)) {
+                known[i] = true;
+                continue;
+            }
+            pool.submit([this, root] { scanNode(root); });
+        }
+        pool.wait();
+        settleLinks();
+        for (size_t i = 0; i < count; ++i) {
+            if (known[i]) continue;
+            directories[i].size = roots[i].bytes.load(std::memory_order_relaxed);
+            if (!listedPaths.empty()) rememberTotal(roots[i].path, directories[i].size);
         }
     }
 
-    // Use red color for hidden files/directories
-    std::string color = isHidden ? "\033[1;30m" : getColor(type, isDirectory);
+    // Total size of a whole tree, the files directly inside it included
+    std::uintmax_t total(const fs::path& directory) {
+        SizeNode root;
+        root.path = directory.string();
+        pool.submit([this, &root] { scanNode(&root); });
+        pool.wait();
+        settleLinks();
+        return root.bytes.load(std::memory_order_relaxed);
+    }
+
+    // The largest files and directories seen by all workers, see collectTop
+    TopSizes takeTop() {
+        TopSizes merged(top.empty() ? 0 : top.front().files.capacity());
+        for (auto& sizes : top) merged.merge(sizes);
+        return merged;
+    }
+
+private:
+    struct SizeNode {
+        std::string path;
+        SizeNode* parent = nullptr;               // nullptr for the directories being listed
+        std::atomic<std::uintmax_t> bytes{0};     // Size of the files seen so far in this subtree
+        std::atomic<int> pending{1};              // Own scan plus unfinished subdirectories
+        std::uint32_t linkDirectory = noDirectory; // --disk-usage: number in linkDirectories (guarded by linksMutex)
+    };
+
+    // --disk-usage: a directory that holds (or is above) a link of a file with several links
+    static constexpr std::uint32_t noDirectory = UINT32_MAX;
+    struct LinkDirectory {
+        std::string path;
+        std::uint32_t parent;         // noDirectory at the top
+        SizeNode* root;               // The node at the top (owned by run() or total()), else nullptr
+        std::uintmax_t bytes = 0;     // Total of the subtree without those files
+        std::uintmax_t settled = 0;   // Those files of the subtree charged to it after the walk
+    };
 
-    std::cout << emoji; // Print emoji before filename
-    std::cout << color; // Use red color for hidden files/directories
-    std::cout << std::setw(20) << std::left << entry.path().filename().string();
+    // Sum the files of one directory and queue its subdirectories
+    // Like std::filesystem::recursive_directory_iterator, symlinks to files are counted
+    // with their target size, and symlinks to directories are not followed
+    void scanNode(SizeNode* node) {
+        PhaseScope phase(Phase::Totals);
+        static thread_local DirectoryScanner scanner;
+        static thread_local IndexRecordBuilder builder;
+        std::uintmax_t bytes = 0;
+        std::uint32_t linkDirectory = noDirectory; // Numbered on the first hard link, see noteLink
+
+        // With --index, an unchanged directory is answered from its cached record, sizes
+        // included (see index.h); either way every subdirectory is queued, so it is covered
+        DirKey key;
+        bool indexed = index && directoryKey(node->path.c_str(), key);
+        IndexRecord record(nullptr);
+        if (indexed && index->lookup(key, record)) {
+            bytes = record.fileBytes();
+            record.forEach([&](const IndexedEntry& cached) {
+                bool isDirectory = (cached.type == DT_DIR);
+                struct statx info;
+                if (cached.type == DT_UNKNOWN && S_ISDIR(cached.mode)) {
+                    // Unknown type: only descend if it is not a symlink to a directory
+                    std::string path = childPath(node->path, cached.name);
+                    isDirectory = statEntry(AT_FDCWD, path.c_str(), STATX_TYPE, info, false) && S_ISDIR(info.stx_mode);
+                }
+                if (isDirectory) {
+                    queueChild(node, cached.name);
+                } else if (!top.empty()) {
+                    noteFile(*node, cached.name, cached.size, cached.mode);
+                }
+            });
+            index->cover(key);
+            node->bytes.fetch_add(bytes, std::memory_order_relaxed);
+            finishNode(node);
+            return;
+        }
+
+        // Lookups go out in batches (meta.h); the tag of each lookup is the d_type of its entry
+        static thread_local StatBatch batch;
+        if (indexed && scanner.open(node->path.c_str())) {
+            // Full metadata for every entry, so the record can serve any later listing
+            DirKey parent;
+            parentKey(node->path, parent);
+            builder.begin(key, parent);
+            auto runBatch = [&] {
+                batch.run(scanner.fd());
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    const char* name = batch.name(i);
+                    auto type = static_cast<unsigned char>(batch.tag(i));
+                    const struct statx& info = batch[i].info;
+                    bool haveInfo = batch[i].ok;
+                    bool isFile = haveInfo && S_ISREG(info.stx_mode);
+                    // The same bytes as the record a listing builds (sizes of files only)
+                    builder.add(name, std::strlen(name), type, haveInfo ? info.stx_mode : 0,
+                                isFile ? info.stx_size : 0, haveInfo ? info.stx_mtime.tv_sec : 0);
+
+                    bool isDirectory = (type == DT_DIR);
+                    if (type == DT_UNKNOWN && haveInfo && S_ISDIR(info.stx_mode)) {
+                        struct statx own;
+                        isDirectory = statEntry(scanner.fd(), name, STATX_TYPE, own, false) && S_ISDIR(own.stx_mode);
+                    }
+                    if (isDirectory) {
+                        queueChild(node, name);
+                        continue;
+                    }
+                    if (isFile) bytes += info.stx_size;
+                    if (!top.empty()) noteFile(*node, name, haveInfo ? info.stx_size : 0, haveInfo ? info.stx_mode : 0);
+                }
+                batch.clear();
+            };
+            ScanEntry raw;
+            while (scanner.next(raw)) {
+                batch.add(raw.name, raw.nameLength, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, true, raw.type);
+                if (batch.full()) runBatch();
+            }
+            if (batch.size() > 0) runBatch();
+            scanner.close();
+            index->store(key, builder.finish());
+            index->cover(key);
+        } else if (scanner.open(node->path.c_str())) {
+            auto runBatch = [&] {
+                batch.run(scanner.fd());
+                for (size_t i = 0; i < batch.size(); ++i) {
+                    const struct statx& info = batch[i].info;
+                    if (batch[i].ok && S_ISREG(info.stx_mode)) {
+                        countFile(node, batch.name(i), info, bytes, linkDirectory);
+                    } else if (!top.empty()) {
+                        noteFile(*node, batch.name(i), 0, batch[i].ok ? info.stx_mode : 0);
+                    }
+                }
+                batch.clear();
+            };
+            ScanEntry raw;
+            while (scanner.next(raw)) {
+                bool isDirectory = (raw.type == DT_DIR);
+                bool sizeKnown = false;
+                struct statx info;
+                if (raw.type == DT_UNKNOWN && statEntry(scanner.fd(), raw.name, fileMask, info, false)) {
+                    isDirectory = S_ISDIR(info.stx_mode);
+                    if (S_ISREG(info.stx_mode)) {
+                        // Not a symlink, so this is already the answer
+                        countFile(node, raw.name, info, bytes, linkDirectory);
+                        sizeKnown = true;
+                    }
+                }
+
+                if (sizeKnown) {
+                    continue;
+                } else if (isDirectory) {
+                    queueChild(node, raw.name);
+                } else {
+                    batch.add(raw.name, raw.nameLength, fileMask, true);
+                    if (batch.full()) runBatch();
+                }
+            }
+            if (batch.size() > 0) runBatch();
+            scanner.close();
+        }
+
+        node->bytes.fetch_add(bytes, std::memory_order_relaxed);
+        finishNode(node);
+    }
+
+    // Queue a subdirectory of a node; the node stays open until the child has finished
+    // A subdirectory whose total is already known (see shareTotals) is not read again
+    void queueChild(SizeNode* node, const char* name) {
+        std::string path = childPath(node->path, name);
+        std::uintmax_t total;
+        if (!listedPaths.empty() && knownTotal(path, total)) {
+            node->bytes.fetch_add(total, std::memory_order_relaxed);
+            return;
+        }
+        SizeNode* child = new SizeNode;
+        child->path = std::move(path);
+        child->parent = node;
+        node->pending.fetch_add(1, std::memory_order_relaxed);
+        pool.submit([this, child] { scanNode(child); });
+    }
+
+    // Close one pending part of a node, passing its total up once everything is counted
+    // The total of a directory with hard links below it is only complete after settleLinks,
+    // which remembers and offers it then
+    void finishNode(SizeNode* node) {
+        while (node && node->pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            SizeNode* parent = node->parent;
+            std::uintmax_t bytes = node->bytes.load(std::memory_order_relaxed);
+            bool settledLater = diskUsage && keepLinkTotal(*node, bytes);
+            if (!parent) return; // Top-level node, owned by run()
+            parent->bytes.fetch_add(bytes, std::memory_order_relaxed);
+            if (!settledLater && !listedPaths.empty() && (listedPaths.count(parent->path) || listedPaths.count(node->path))) {
+                rememberTotal(node->path, bytes);
+            }
+            if (!top.empty()) noteDirectory(*node, !settledLater);
+            delete node;
+            node = parent;
+        }
+    }
+
+    // Add a regular file to the bytes of its directory; with --disk-usage, a file with several
+    // links is only offered to linkOwners, and counted by settleLinks
+    void countFile(SizeNode* node, const char* name, const struct statx& info, std::uintmax_t& bytes,
+                   std::uint32_t& linkDirectory) {
+        std::uintmax_t size = fileBytes(info);
+        bool linked = diskUsage && hasHardLinks(info);
+        if (linked) noteLink(node, name, info, size, linkDirectory);
+        else bytes += size;
+        if (!top.empty()) noteFile(*node, name, size, info.stx_mode, linked);
+    }
+
+    // Offer one link of a file with several links; linkDirectory caches the number of the
+    // directory of node (see numberLinkDirectory) for the scan of that directory
+    void noteLink(SizeNode* node, const char* name, const struct statx& info, std::uintmax_t size,
+                  std::uint32_t& linkDirectory) {
+        if (linkDirectory == noDirectory) linkDirectory = numberLinkDirectory(node);
+        LinkOwner link;
+        link.rank = linkRank(node->path, name);
+        link.size = size;
+        link.directory = linkDirectory;
+        link.mode = info.stx_mode;
+        linkOwners.offer(fileDevice(info), info.stx_ino, link);
+    }
+
+    // Give a node, and every ancestor without one yet, a number in linkDirectories
+    // The ancestors are still open (a node is only freed once its subtree is done)
+    std::uint32_t numberLinkDirectory(SizeNode* node) {
+        static thread_local std::vector<SizeNode*> chain;
+        std::lock_guard<std::mutex> lock(linksMutex);
+        chain.clear();
+        for (SizeNode* open = node; open && open->linkDirectory == noDirectory; open = open->parent) chain.push_back(open);
+        for (size_t i = chain.size(); i-- > 0;) {
+            SizeNode* open = chain[i];
+            open->linkDirectory = static_cast<std::uint32_t>(linkDirectories.size());
+            linkDirectories.push_back({open->path, open->parent ? open->parent->linkDirectory : noDirectory,
+                                       open->parent ? nullptr : open});
+        }
+        return node->linkDirectory;
+    }
+
+    // Keep the total of a finished node that has links below it, returns false if it has none
+    bool keepLinkTotal(const SizeNode& node, std::uintmax_t bytes) {
+        std::lock_guard<std::mutex> lock(linksMutex);
+        if (node.linkDirectory == noDirectory) return false;
+        linkDirectories[node.linkDirectory].bytes = bytes;
+        return true;
+    }
+
+    // Rank of a link: a hash (FNV-1a) of its path, fixed for a given tree, unlike the order in
+    // which the threads come across the links
+    static std::uint64_t linkRank(const std::string& directory, const char* name) {
+        std::uint64_t hash = 0xcbf29ce484222325ull;
+        auto add = [&hash](const char* text, size_t length) {
+            for (size_t i = 0; i < length; ++i) hash = (hash ^ static_cast<unsigned char>(text[i])) * 0x100000001b3ull;
+        };
+        add(directory.data(), directory.size());
+        add("/", 1);
+        add(name, std::strlen(name));
+        return hash;
+    }
+
+    // The name of the link with a rank in a directory (only looked for to show it in --top)
+    static bool linkName(const std::string& directory, std::uint64_t rank, std::string& name) {
+        DirectoryScanner scanner;
+        if (!scanner.open(directory.c_str())) return false;
+        ScanEntry raw;
+        while (scanner.next(raw)) {
+            if (linkRank(directory, raw.name) != rank) continue;
+            name.assign(raw.name, raw.nameLength);
+            return true;
+        }
+        return false;
+    }
+
+    // --disk-usage, once the walk is done: charge every file with several links to the link
+    // with the smallest rank, unless an earlier part of the listing counted it (InodeSet), and
+    // complete the totals of the directories above those links
+    void settleLinks() {
+        if (!diskUsage) return;
+        std::vector<LinkOwner> charged; // --top: candidates for the largest files
+        linkOwners.forEach([&](std::uint64_t device, std::uint64_t inode, const LinkOwner& owner) {
+            if (!InodeSet::instance().insert(device, inode)) return;
+            for (std::uint32_t d = owner.directory; d != noDirectory; d = linkDirectories[d].parent) {
+                linkDirectories[d].settled += owner.size;
+            }
+            if (!top.empty()) charged.push_back(owner);
+        });
+        linkOwners.clear();
+
+        for (const LinkDirectory& directory : linkDirectories) {
+            if (directory.root) {
+                directory.root->bytes.fetch_add(directory.settled, std::memory_order_relaxed);
+                continue;
+            }
+            std::uintmax_t total = directory.bytes + directory.settled;
+            const std::string& parentPath = linkDirectories[directory.parent].path;
+            if (!listedPaths.empty() && (listedPaths.count(parentPath) || listedPaths.count(directory.path))) {
+                rememberTotal(directory.path, total);
+            }
+            if (!top.empty() && top.front().directories.wants(total)) {
+                top.front().directories.offer({total, directory.path, S_IFDIR});
+            }
+        }
+
+        // Largest first, so the names are only looked up while a file could still get in
+        std::sort(charged.begin(), charged.end(), [](const LinkOwner& a, const LinkOwner& b) {
+            return a.size != b.size ? a.size > b.size : a.rank < b.rank;
+        });
+        for (const LinkOwner& owner : charged) {
+            TopList& files = top.front().files;
+            if (!files.wants(owner.size)) break;
+            const std::string& directory = linkDirectories[owner.directory].path;
+            std::string name;
+            if (!linkName(directory, owner.rank, name) || !topPattern->matches(name)) continue;
+            files.offer({owner.size, childPath(directory, name.c_str()), owner.mode});
+        }
+        linkDirectories.clear();
+    }
+
+    // Bytes a regular file adds to the totals: its size, or its allocated blocks (--disk-usage)
+    std::uintmax_t fileBytes(const struct statx& info) const {
+        return diskUsage ? allocatedBytes(info) : info.stx_size;
+    }
+
+    // --top: count a file (or any other non-directory), and keep it if it is among the largest matching ones of this worker
+    // The path is only built for the few files that actually get in; a file with several links
+    // (linked) is kept by settleLinks instead, through one of them, so no file shows up twice
+    void noteFile(const SizeNode& node, const char* name, std::uintmax_t size, mode_t mode, bool linked = false) {
+        TopSizes& sizes = top[WorkStealingPool::workerIndex()];
+        if (S_ISDIR(mode)) {
+            sizes.directoryCount++; // A symlink to a directory, counted but not descended into
+            return;
+        }
+        sizes.fileCount++;
+        if (linked || !S_ISREG(mode) || !sizes.files.wants(size)) return;
+        if (!topPattern->matches(name, std::strlen(name))) return;
+        sizes.files.offer({size, childPath(node.path, name), mode});
+    }
+
+    // --top: count a finished directory below the listed one, and keep it if it is among the largest
+    // (offer is false when its total is only known after settleLinks, which offers it then)
+    void noteDirectory(SizeNode& node, bool offer) {
+        TopSizes& sizes = top[WorkStealingPool::workerIndex()];
+        sizes.directoryCount++;
+        if (!offer) return;
+        std::uintmax_t size = node.bytes.load(std::memory_order_relaxed);
+        if (sizes.directories.wants(size)) sizes.directories.offer({size, std::move(node.path), S_IFDIR});
+    }
+
+    bool knownTotal(const std::string& path, std::uintmax_t& total) {
+        std::lock_guard<std::mutex> lock(knownMutex);
+        auto found = knownTotals.find(path);
+        if (found == knownTotals.end()) return false;
+        total = found->second;
+        return true;
+    }
+
+    void rememberTotal(const std::string& path, std::uintmax_t total) {
+        std::lock_guard<std::mutex> lock(knownMutex);
+        knownTotals.emplace(path, total);
+    }
+
+    static std::string childPath(const std::string& directory, const char* name) {
+        if (!directory.empty() && directory.back() == '/') return directory + name;
+        return directory + "/" + name;
+    }
+
+    WorkStealingPool& pool;
+    DirectoryIndex* index;            // --index cache, or nullptr
+    bool diskUsage;                   // --disk-usage: allocated blocks, hard links once
+    std::vector<TopSizes> top;        // --top: one per worker, empty otherwise
+    const PatternMatcher* topPattern = nullptr;
+    unsigned int fileMask = STATX_TYPE | STATX_SIZE; // Fields looked up for files
+    std::unordered_set<std::string> listedPaths;   // shareTotals: the listed directories
+    std::mutex knownMutex;                          // Guards knownTotals
+    std::unordered_map<std::string, std::uintmax_t> knownTotals; // Totals of what they list
+    LinkOwners linkOwners;                          // --disk-usage: the link each file is charged to
+    std::mutex linksMutex;                          // Guards linkDirectories and SizeNode::linkDirectory
+    std::vector<LinkDirectory> linkDirectories;     // Directories with such links below them
+};
+
+// Print a single file or directory entry with details
+std::uintmax_t printEntry(const DirEntry& entry, bool showTotalSize) {
+    bool isDirectory = entry.isDirectory;
+    const RenderTable& render = renderTable();
+
+    // Emoji, then the color of the type (dark gray for hidden files/directories)
+    OutputWriter& out = output();
+    out.write(render.style(entry.type, isDirectory, entry.isHidden).listPrefix());
+    out.pad(entry.name, displayWidth(entry.name), 20);
 
     std::uintmax_t size = 0;
 
     // Always show details
-    std::cout << " " << getPermissions(entry.path());
+    out.put(' ');
+    out.write(getPermissions(entry));
 
-    if (entry.is_regular_file()) {
-        size = entry.file_size();
-        std::cout << " " << std::setw(10) << formatSize(size);
+    char sizeText[sizeTextCapacity];
+    if (entry.isRegularFile) {
+        size = entry.size;
+        out.put(' ');
+        out.pad(std::string_view(sizeText, formatSizeTo(sizeText, size)), 10);
     }
 
     if (isDirectory && showTotalSize) {
         // Only show directory size if -t is used and -r is NOT used
-        size = calculateDirectorySize(entry.path()); // Calculate directory size here
-        std::cout << " " << std::setw(10) << formatSize(size) << " (total)";
+        size = entry.size; // Total computed by SizeAggregator
+        out.put(' ');
+        out.pad(std::string_view(sizeText, formatSizeTo(sizeText, size)), 10);
+        out.write(" (total)");
     }
 
-    if (!isDirectory) {
-        auto ftime = entry.last_write_time();
-        auto sctp = to_time_t(ftime);
-        std::cout << " " << std::put_time(std::localtime(&sctp), "%Y-%m-%d %H:%M:%S");
+    if (!isDirectory && entry.hasStat) {
+        static thread_local TimestampFormatter timestamps;
+        char timestamp[timestampTextCapacity + 1];
+        timestamp[0] = ' ';
+        size_t length = timestamps.format(timestamp + 1, entry.mtime);
+        out.write(timestamp, length + 1);
     }
 
-    std::cout << "\033[0m" << std::endl; // Reset color
+    out.write(render.reset); // Reset color
+    out.endLine();
     return size; // Return the size of the entry
 }
 
-// Function to check if a file or directory is hidden
-bool isHidden(const std::filesystem::directory_entry& entry) {
-    return entry.path().filename().string().front() == '.';
+// The part of a name that a cell of the multi-column view shows
+struct CellName {
+    std::uint16_t length; // Bytes of the name that are shown
+    std::uint16_t width;  // Columns they take, the truncation marker included
+    bool truncated;       // Cut short and followed by the marker
+};
+
+constexpr size_t maxCellNameWidth = 15; // Longer names are cut to 14 columns and a ">"
+
+// Fit a name into a cell, cutting it on a character boundary if it is too wide
+CellName fitCellName(std::string_view name) {
+    FittedText shown = fitWidth(name, maxCellNameWidth);
+    if (shown.length == name.size()) {
+        return {static_cast<std::uint16_t>(shown.length), static_cast<std::uint16_t>(shown.width), false};
+    }
+    shown = fitWidth(name, maxCellNameWidth - 1);
+    return {static_cast<std::uint16_t>(shown.length), static_cast<std::uint16_t>(shown.width + 1), true};
 }
 
-// Helper function to convert a string to lowercase
-std::string toLower(const std::string& str) {
-    std::string lowerStr = str;
-    std::transform(lowerStr.begin(), lowerStr.end(), lowerStr.begin(), ::tolower);
-    return lowerStr;
+// Print one cell of the multi-column view (emoji and name, padded to cellWidth columns)
+void printColumnCell(const DirEntry& entry, const CellName& shown, size_t cellWidth) {
+    const RenderTable& render = renderTable();
+    const RenderTemplate& style = render.style(entry.type, entry.isDirectory, entry.isHidden);
+
+    // Print with color, emoji, and reset color
+    OutputWriter& out = output();
+    out.write(style.widePrefix());
+    out.write(entry.name.data(), shown.length);
+    if (shown.truncated) out.write(render.truncated); // Bright yellow ">"
+    for (size_t i = style.width + shown.width; i < cellWidth; ++i) out.put(' ');
+    out.write(render.reset);
 }
 
-// Display directory contents in a multi-column format
-void displayMultiColumn(const std::vector<std::filesystem::directory_entry>& entries) {
-    // Get terminal width dynamically
-    struct winsize w;
+// Width of the terminal in columns
+size_t terminalWidth() {
+    struct winsize w = {};
     ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
-    int maxWidth = w.ws_col > 0 ? w.ws_col : 80; // Fallback to 80 if detection fails
-
-    const int columnWidth = 17; // Fixed width for each column
-    int numColumns = maxWidth / (columnWidth + 1); // Calculate number of columns
-    int numEntries = entries.size();
-    int numRows = (numEntries + numColumns - 1) / numColumns; // Round up to fit all entries
-
-    for (int row = 0; row < numRows; ++row) {
-        for (int col = 0; col < numColumns; ++col) {
-            int index = row * numColumns + col; // Calculate index for left-to-right order
-            if (index < numEntries) {
-                const auto& entry = entries[index];
-                bool isDirectory = entry.is_directory();
-                bool hidden = isHidden(entry); // Check if the file is hidden
-
-                FileType type = isDirectory ? FileType::Other : categorizeFile(entry);
-
-                // Assign emoji based on file type
-                std::string emoji;
-                if (isDirectory) emoji = "📂 ";
-                else {
-                    switch (type) {
-                        case FileType::Programming: emoji = "💻 "; break;
-                        case FileType::Text: emoji = "📜 "; break;
-                        case FileType::Video: emoji = "🎬 "; break;
-                        case FileType::Picture: emoji = "🖼️ "; break;
-                        case FileType::Executable: emoji = "⚙️ "; break;
-                        case FileType::Compressed: emoji = "🎁 "; break;
-                        default: emoji = "📄 ";
-                    }
-                }
+    return w.ws_col > 0 ? w.ws_col : 80; // Fallback to 80 if detection fails
+}
 
-                // Apply color: Red for hidden files and directories
-                std::string color = hidden ? "\033[1;30m" : getColor(type, isDirectory);
+// Print the "path:" line that starts every subdirectory of a recursive listing (and every
+// listed directory when there are several), after an empty line unless it comes first
+void printHeader(const fs::path& path, bool separate = true) {
+    OutputWriter& out = output();
+    if (separate) out.endLine();
+    out.write(path.native());
+    out.put(':');
+    out.endLine();
+}
 
-                // Truncate filenames that are too long (max 15 chars, excluding symbol)
-                std::string name = entry.path().filename().string();
-                const int maxNameLength = 15; // Fixed max length for filenames
-                if (name.length() > maxNameLength) {
-                    name = name.substr(0, maxNameLength - 1) + "\033[1;33m>\033[0m"; // Bright yellow ">"
-                }
+// Display directory contents in a multi-column format
+// As with ls -C, every column is only as wide as its widest cell, and the layout with the most
+// columns that still fits the terminal wins. Entries are placed left to right, so in a layout
+// of k columns entry i lands in column i % k; every candidate layout is measured in the same
+// single pass over the cells, and a layout is dropped as soon as it gets too wide.
+void displayMultiColumn(EntryRange entries) {
+    const size_t count = entries.size();
+    if (count == 0) return;
+    const size_t gap = 2;                       // Spaces between two columns
+    const size_t narrowestCell = 3 + 1;         // Emoji, space and a single column name
+    const size_t lineWidth = terminalWidth();
+    const RenderTable& render = renderTable();
 
-                // Print with color, emoji, and reset color, ensuring fixed column width
-                std::cout << color << emoji << std::setw(columnWidth - 2) << std::left << name << "\033[0m";
-            }
+    // Measure every cell once
+    static thread_local std::vector<CellName> names;
+    static thread_local std::vector<std::uint16_t> cellWidths;
+    names.resize(count);
+    cellWidths.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const DirEntry& entry = entries[i];
+        names[i] = fitCellName(entry.name);
+        cellWidths[i] = render.style(entry.type, entry.isDirectory, entry.isHidden).width + names[i].width;
+    }
+
+    // Candidate layouts of 1..maxColumns columns; the column widths of layout k start at k*(k-1)/2
+    const size_t maxColumns = std::max<size_t>(1, std::min(count, (lineWidth + gap) / (narrowestCell + gap)));
+    static thread_local std::vector<std::uint16_t> columnWidths;
+    static thread_local std::vector<size_t> lineLengths; // 0: that layout no longer fits
+    columnWidths.assign(maxColumns * (maxColumns + 1) / 2, 0);
+    lineLengths.resize(maxColumns + 1);
+    for (size_t columns = 1; columns <= maxColumns; ++columns) lineLengths[columns] = (columns - 1) * gap;
+
+    for (size_t i = 0; i < count; ++i) {
+        std::uint16_t width = cellWidths[i];
+        for (size_t columns = 2; columns <= maxColumns; ++columns) {
+            size_t& lineLength = lineLengths[columns];
+            if (lineLength == 0) continue;
+            std::uint16_t& columnWidth = columnWidths[columns * (columns - 1) / 2 + i % columns];
+            if (width <= columnWidth) continue;
+            lineLength += width - columnWidth;
+            columnWidth = width;
+            if (lineLength >= lineWidth) lineLength = 0;
         }
-        std::cout << std::endl; // Move to the next row
+    }
+    size_t columns = maxColumns;
+    while (columns > 1 && lineLengths[columns] == 0) --columns;
+    const std::uint16_t* widths = &columnWidths[columns * (columns - 1) / 2];
+
+    OutputWriter& out = output();
+    for (size_t row = 0; row * columns < count; ++row) {
+        for (size_t column = 0; column < columns; ++column) {
+            size_t index = row * columns + column; // Left-to-right order
+            if (index >= count) break;
+            bool last = column + 1 == columns || index + 1 == count;
+            printColumnCell(entries[index], names[index], last ? 0 : widths[column] + gap);
+        }
+        out.endLine(); // Move to the next row
     }
 }
 
-// List directory contents with optional recursive and pattern matching
-void listDirectoryContents(const fs::path& path, const std::string& pattern, 
-    bool recursive, bool showTotalSize, 
-    bool forceList, bool forceWide, 
-    int& totalFiles, int& totalDirs, std::uintmax_t& totalSizeShown, const int& screenHeight) {
+// Read one directory into a (reset) listing and add its entries to the counters
+// The entries have their metadata, but are not categorized or sorted yet (see sortListing)
+void readDirectory(const fs::path& path, const ListOptions& options, DirectoryListing& listing, Totals& totals) {
+    PhaseScope phase(Phase::Scan);
+    listing.reset();
 
-    std::vector<fs::directory_entry> directories; // Store directories
-    std::vector<fs::directory_entry> files;       // Store files
+    const PatternMatcher& pattern = options.pattern;
 
-    for (const auto& entry : fs::directory_iterator(path)) {
-        // Skip entries that don't match the pattern
-        if (!pattern.empty() && fnmatch(pattern.c_str(), entry.path().filename().c_str(), FNM_PATHNAME) != 0) {
-            continue;
+    // With --index, the names of an unchanged directory come from its cached record, but their
+    // metadata is looked up as usual: a file can grow without its directory changing (index.h)
+    // The index keeps every entry, whatever the pattern of this run, so with --index the entries
+    // that don't match are only dropped once they have been checked against the record
+    DirectoryIndex* index = options.index;
+    DirKey key;
+    bool indexed = index && directoryKey(path.c_str(), key);
+    IndexRecord record(nullptr);
+    bool cached = indexed && index->lookup(key, record);
+    static thread_local std::vector<unsigned char> rawTypes; // d_type of every entry (--index)
+    static thread_local std::vector<bool> matched;           // Pattern matches (--index)
+    rawTypes.clear();
+    matched.clear();
+    auto addEntry = [&](const ScanEntry& raw) {
+        bool matches = pattern.matches(raw.name, raw.nameLength);
+        if (!matches && !indexed) return; // Skip entries that don't match the pattern
+        listing.entries.push_back(makeNamedEntry(raw, listing.names));
+        if (indexed) {
+            rawTypes.push_back(raw.type);
+            matched.push_back(matches);
         }
+    };
 
-        if (entry.is_directory()) {
-            directories.push_back(entry); // Add directory to the list
-            totalDirs++; // Increment directory count
-            if (showTotalSize && !recursive) {
-                // Calculate directory size only if -t is used and -r is NOT used
-                std::uintmax_t dirSize = calculateDirectorySize(entry.path());
-                totalSizeShown += dirSize; // Add directory size to total
-            }
-        } else {
-            files.push_back(entry); // Add file to the list
-            totalFiles++; // Increment file count
-            totalSizeShown += entry.file_size(); // Add file size to total
+    // One scanner per thread, so its batch buffer is reused for every directory
+    static thread_local DirectoryScanner scanner;
+    static thread_local IndexRecordBuilder builder;
+    if (cached) {
+        int dirFd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) return;
+        record.forEach([&](const IndexedEntry& entry) {
+            ScanEntry raw = {entry.name, entry.nameLength, entry.type, 0, 0};
+            addEntry(raw);
+        });
+        statDirEntries(dirFd, listing.entries.data(), listing.entries.size(), options);
+        close(dirFd);
+    } else {
+        if (!scanner.open(path.c_str())) {
+            return; // Directory cannot be read (e.g. permission denied)
         }
+        // First all names, then their metadata as a batch
+        ScanEntry raw;
+        while (scanner.next(raw)) addEntry(raw);
+        statDirEntries(scanner.fd(), listing.entries.data(), listing.entries.size(), options);
+        scanner.close();
     }
 
-    // Sort directories alphabetically (case-insensitive)
-    std::sort(directories.begin(), directories.end(), [](const auto& a, const auto& b) {
-        return toLower(a.path().filename().string()) < toLower(b.path().filename().string());
-    });
+    if (indexed) {
+        DirKey parent = cached ? record.parent() : DirKey();
+        if (!cached) parentKey(path.string(), parent);
+        builder.begin(key, parent);
+        size_t kept = 0;
+        for (size_t i = 0; i < listing.entries.size(); ++i) {
+            const DirEntry& entry = listing.entries[i];
+            builder.add(entry.name.data(), entry.name.size(), rawTypes[i], entry.hasStat ? entry.mode : 0,
+                        entry.size, entry.mtime);
+            if (matched[i]) listing.entries[kept++] = entry;
+        }
+        listing.entries.resize(kept);
+        // Rewritten only if it changed, so an unchanged tree doesn't rewrite the index file
+        std::string rebuilt = builder.finish();
+        if (!cached || rebuilt != record.bytes()) index->store(key, std::move(rebuilt));
+    }
 
-    // Sort files by category and then alphabetically (case-insensitive)
-    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
-        FileType typeA = categorizeFile(a);
-        FileType typeB = categorizeFile(b);
-        if (typeA != typeB) {
-            return typeA < typeB; // Sort by category first
+    for (const auto& entry : listing.entries) {
+        if (entry.isDirectory) {
+            listing.directoryCount++;
+            totals.dirs++; // Increment directory count
+        } else {
+            totals.files++; // Increment file count
+            if (!entry.sharedLink) totals.size += entry.size; // Add file size to total
         }
-        return toLower(a.path().filename().string()) < toLower(b.path().filename().string()); // Then alphabetically
-    });
+    }
 
-    // Combine directories and files into a single list for multi-column display
-    std::vector<fs::directory_entry> allEntries;
-    allEntries.insert(allEntries.end(), directories.begin(), directories.end());
-    allEntries.insert(allEntries.end(), files.begin(), files.end());
+}
+
+// Categorize the entries of a listing read by readDirectory and put them in display order
+// (--sort): directories first, then files, by default by category and alphabetically
+// (case-insensitive). With --head, the listing keeps only the entries that are shown, and only
+// those are sorted; otherwise at least the first window entries end up in order.
+// Huge listings are categorized and sorted on -j threads (see parallelSortThreshold).
+// Returns the number of entries that are in order.
+size_t sortListing(DirectoryListing& listing, const ListOptions& options, size_t window = SIZE_MAX) {
+    size_t count = listing.entries.size();
+    unsigned threads = count >= parallelSortThreshold ? options.jobs : 1;
+    DirEntry* entries = listing.entries.data();
+    {
+        PhaseScope categorizePhase(Phase::Categorize);
+        forEachChunk(count, threads, Phase::Categorize, [entries](size_t, size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) finishEntry(entries[i]);
+        });
+    }
+    size_t shown = options.head ? std::min(options.head, count) : count;
+    size_t ordered = options.head ? shown : std::min(window, count);
+    countEvent(PerfEvent::SortedEntries, count);
+    sortEntries(entries, count, options.sortOrder, ordered, threads);
+    if (shown < count) {
+        listing.entries.resize(shown);
+        listing.directoryCount = std::min(listing.directoryCount, shown);
+    }
+    return ordered;
+}
+
+// Entries to sort before the first of them are shown: with -p and -l only the first screen,
+// the rest is sorted while that screen is already on the terminal
+size_t firstScreen(const ListOptions& options) {
+    if (!options.paged || !options.forceList || options.format != OutputFormat::Text) return SIZE_MAX;
+    return static_cast<size_t>(std::max(options.screenHeight, 1));
+}
+
+// Print sorted entries of one directory in list or multi-column view
+void displayDirectory(const fs::path& path, EntryRange allEntries, const ListOptions& options) {
+    PhaseScope phase(Phase::Render);
+    // Directories and files are already one contiguous, sorted list
+
+    if (options.format != OutputFormat::Text) {
+        for (const auto& entry : allEntries) printRecord(entry, path, options.format);
+        return;
+    }
 
     // Display in multi-column format if conditions are met
-    if (!forceList && (forceWide || allEntries.size() > (screenHeight - 3))) {
+    if (!options.forceList && (options.forceWide || allEntries.size() > static_cast<size_t>(options.screenHeight - 3))) {
         displayMultiColumn(allEntries);
     } else {
         // Display in detailed list format
         for (const auto& entry : allEntries) {
-            printEntry(entry, showTotalSize && !recursive);
+            printEntry(entry, options.showTotalSize && !options.recursive);
         }
     }
+}
+
+// A directory of a recursive listing: read by a pool worker, sorted by a sorter, printed by the main thread
+struct DirNode {
+    fs::path path;
+    DirNode* parent = nullptr;                      // Enclosing directory (alive until this node is printed)
+    int depth = 0;                                  // Levels below the listed directory
+    std::uint64_t dev = 0;                          // Identity of the directory, for cycle detection
+    std::uint64_t ino = 0;
+    std::uint64_t rootDev = 0;                      // Device of the listed directory it is below, for -x
+    std::unique_ptr<DirectoryListing> listing;      // Sorted entries, recycled once printed
+    std::vector<std::unique_ptr<DirNode>> children; // One node per subdirectory, in display order
+    bool skipped = false;                           // Not listed: a cycle, or another file system with -x
+    bool ready = false;                             // Set once sorted (guarded by the traversal mutex)
+    size_t deferredSlot = SIZE_MAX;                 // Position in the deferred stack (guarded by admitMutex)
+};
+
+// Parallel recursive listing
+// Every directory passes three stages, each on its own threads:
+//  1. read: a worker of the work-stealing pool reads the names and metadata (I/O bound)
+//  2. sort: a sorter thread categorizes and sorts the entries and queues the subdirectories
+//     (CPU bound); the readers hand directories over through a bounded lock-free queue
+//  3. print: the calling thread prints the nodes depth-first, in the same order as a serial
+//     listing would
+// Backpressure keeps the stages in step. When the sort queue is full, a reader sorts the
+// directory itself instead of queueing it. And only a limited number of directories may be
+// read but not yet printed: further subdirectories wait on a deferred stack until the printer
+// has caught up, except the one the printer is waiting for, which goes ahead at once.
+// While it waits, the printer also helps with the sorting.
+// Every worker keeps its own counters, which are merged when the traversal is done. Listings
+// are handed back after printing and reused for later directories, so their arenas are only
+// grown, never freed and reallocated, while the tree is walked.
+// Nothing recurses: workers queue one task per subdirectory and the printer walks the tree
+// with an explicit stack, so the depth of a tree is never limited by the call stack.
+// A directory that is its own ancestor (a symlink or bind mount cycle) is not descended into.
+class RecursiveListing {
+public:
+    explicit RecursiveListing(const ListOptions& options)
+        : options(options), pool(options.jobs), workerTotals(pool.size()),
+          sortQueue(256), admitLimit(256 + 64 * static_cast<size_t>(pool.size())) {
+        unsigned sorterCount = std::max(1u, pool.size() / 2);
+        for (unsigned i = 0; i < sorterCount; ++i) sorters.emplace_back([this] { sortLoop(); });
+    }
 
-    // Recursively list subdirectories
-    if (recursive) {
-        for (const auto& dir : directories) {
-            std::cout << "\n" << dir.path().string() << ":\n";
-            listDirectoryContents(dir, pattern, recursive, showTotalSize, forceList, forceWide, totalFiles, totalDirs, totalSizeShown, screenHeight);
+    ~RecursiveListing() {
+        sortQueue.close();
+        for (auto& sorter : sorters) sorter.join();
+    }
+
+    // List the trees below roots, one after the other, and return the merged counters
+    // All trees are read by the same pool: the next one is admitted like any subdirectory, so
+    // it is already being read while the one before it is still printed.
+    Totals run(const std::vector<fs::path>& roots) {
+        std::vector<DirNode> rootNodes(roots.size());
+        for (size_t i = 0; i < roots.size(); ++i) {
+            rootNodes[i].path = roots[i];
+            DirKey key;
+            if (directoryKey(roots[i].c_str(), key)) {
+                rootNodes[i].dev = rootNodes[i].rootDev = key.dev;
+                rootNodes[i].ino = key.ino;
+            }
         }
+        if (!rootNodes.empty()) {
+            admitted = 1;
+            pool.submit([this, &rootNodes] { readNode(rootNodes.front()); });
+            for (size_t i = rootNodes.size(); i-- > 1;) admitOrDefer(&rootNodes[i]);
+        }
+        bool headers = roots.size() > 1 && options.format == OutputFormat::Text;
+        for (size_t i = 0; i < rootNodes.size(); ++i) {
+            if (headers) printHeader(roots[i], i > 0);
+            printTree(rootNodes[i]);
+        }
+        pool.wait();
+
+        Totals totals;
+        for (const auto& workerTotal : workerTotals) totals.merge(workerTotal);
+        return totals;
     }
+
+private:
+    // Stage 1 (pool worker): read a directory and pass it on to the sorters
+    void readNode(DirNode& node) {
+        Totals& totals = workerTotals[WorkStealingPool::workerIndex()];
+        DirKey key;
+        if (node.parent && directoryKey(node.path.c_str(), key)) {
+            node.dev = key.dev;
+            node.ino = key.ino;
+            node.skipped = (options.oneFileSystem && key.dev != node.rootDev) || isCycle(node);
+        }
+        if (output().closed()) node.skipped = true; // The pager was quit: nothing more is read
+        if (node.skipped) {
+            markReady(node);
+            return;
+        }
+
+        node.listing = acquireListing();
+        readDirectory(node.path, options, *node.listing, totals);
+        if (!sortQueue.tryPush(&node)) sortNode(node); // Sorters are behind: do it here
+    }
+
+    // Stage 2 (sorter, or a reader or the printer helping out): sort a directory, queue its
+    // subdirectories and publish it
+    // The node may be printed and freed as soon as it is marked ready, so that comes last
+    void sortNode(DirNode& node) {
+        sortListing(*node.listing, options);
+        bool descend = options.maxDepth < 0 || node.depth < options.maxDepth;
+        for (const auto& dir : descend ? node.listing->directories() : EntryRange()) {
+            node.children.push_back(std::make_unique<DirNode>());
+            DirNode* childNode = node.children.back().get();
+            childNode->path = node.path / dir.name;
+            childNode->parent = &node;
+            childNode->depth = node.depth + 1;
+            childNode->rootDev = node.rootDev;
+        }
+        // Deferred children are pushed last to first, so the first one is taken first
+        for (size_t i = node.children.size(); i-- > 0;) admitOrDefer(node.children[i].get());
+        markReady(node);
+    }
+
+    void sortLoop() {
+        DirNode* node;
+        while (sortQueue.pop(node)) sortNode(*node);
+    }
+
+    void markReady(DirNode& node) {
+        {
+            std::lock_guard<std::mutex> lock(readyMutex);
+            node.ready = true;
+        }
+        readyCv.notify_all();
+    }
+
+    // Start reading a directory now, or defer it while too many are waiting to be printed
+    void admitOrDefer(DirNode* node) {
+        {
+            std::lock_guard<std::mutex> lock(admitMutex);
+            if (admitted >= admitLimit) {
+                node->deferredSlot = deferred.size();
+                deferred.push_back(node);
+                return;
+            }
+            admitted++;
+        }
+        pool.submit([this, node] { readNode(*node); });
+    }
+
+    // A directory has been printed (or skipped): start deferred ones in its place
+    void finishAdmitted() {
+        std::vector<DirNode*> started;
+        {
+            std::lock_guard<std::mutex> lock(admitMutex);
+            admitted--;
+            while (admitted < admitLimit && !deferred.empty()) {
+                DirNode* node = deferred.back();
+                deferred.pop_back();
+                node->deferredSlot = SIZE_MAX;
+                admitted++;
+                started.push_back(node);
+            }
+        }
+        for (DirNode* node : started) pool.submit([this, node] { readNode(*node); });
+    }
+
+    // The printer needs this directory next: start it even if it was deferred
+    void admitNow(DirNode& node) {
+        {
+            std::lock_guard<std::mutex> lock(admitMutex);
+            if (node.deferredSlot == SIZE_MAX) return; // Already started
+            DirNode* last = deferred.back();
+            deferred[node.deferredSlot] = last;
+            last->deferredSlot = node.deferredSlot;
+            deferred.pop_back();
+            node.deferredSlot = SIZE_MAX;
+            admitted++;
+        }
+        pool.submit([this, &node] { readNode(node); });
+    }
+
+    // True if the directory of a node is also one of its ancestors
+    // (the ancestors are still alive: a node is only freed after its whole subtree is printed)
+    static bool isCycle(const DirNode& node) {
+        if (node.dev == 0 && node.ino == 0) return false;
+        for (const DirNode* ancestor = node.parent; ancestor; ancestor = ancestor->parent) {
+            if (ancestor->dev == node.dev && ancestor->ino == node.ino) return true;
+        }
+        return false;
+    }
+
+    // Stage 3 (calling thread): print the nodes depth-first, each one as soon as it is ready
+    void printTree(DirNode& root) {
+        struct Frame {
+            DirNode* node;
+            size_t next; // Next child to print
+        };
+        std::vector<Frame> stack;
+
+        printNode(root);
+        stack.push_back({&root, 0});
+        while (!stack.empty()) {
+            Frame& frame = stack.back();
+            if (frame.next == frame.node->children.size()) {
+                stack.pop_back();
+                if (!stack.empty()) {
+                    // Free the subtree as soon as it has been printed
+                    Frame& parent = stack.back();
+                    parent.node->children[parent.next++].reset();
+                }
+                continue;
+            }
+
+            DirNode* child = frame.node->children[frame.next].get();
+            waitReady(*child);
+            if (child->skipped) {
+                frame.node->children[frame.next++].reset();
+                finishAdmitted();
+                continue;
+            }
+
+            if (options.format == OutputFormat::Text) printHeader(child->path);
+            printNode(*child);
+            stack.push_back({child, 0});
+        }
+    }
+
+    // Wait for a node to be sorted, then print its entries and recycle its listing
+    void printNode(DirNode& node) {
+        waitReady(node);
+        if (!node.listing) return;
+        displayDirectory(node.path, node.listing->all(), options);
+        releaseListing(std::move(node.listing));
+        finishAdmitted();
+    }
+
+    // Wait for a node, helping the sorters in the meantime
+    void waitReady(DirNode& node) {
+        admitNow(node);
+        DirNode* queued;
+        while (!isReady(node) && sortQueue.tryPop(queued)) sortNode(*queued);
+        std::unique_lock<std::mutex> lock(readyMutex);
+        readyCv.wait(lock, [&node] { return node.ready; });
+    }
+
+    bool isReady(DirNode& node) {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        return node.ready;
+    }
+
+    // Take a spare listing, or a new one if all of them are in use
+    std::unique_ptr<DirectoryListing> acquireListing() {
+        {
+            std::lock_guard<std::mutex> lock(spareMutex);
+            if (!spareListings.empty()) {
+                std::unique_ptr<DirectoryListing> listing = std::move(spareListings.back());
+                spareListings.pop_back();
+                return listing;
+            }
+        }
+        return std::make_unique<DirectoryListing>();
+    }
+
+    // Hand a printed listing back for reuse
+    void releaseListing(std::unique_ptr<DirectoryListing> listing) {
+        std::lock_guard<std::mutex> lock(spareMutex);
+        spareListings.push_back(std::move(listing));
+    }
+
+    const ListOptions& options;
+    WorkStealingPool pool;            // Stage 1: readers
+    std::vector<Totals> workerTotals; // One set of counters per worker
+    BoundedQueue<DirNode*> sortQueue; // Read directories on their way to stage 2
+    std::vector<std::thread> sorters; // Stage 2
+    std::mutex readyMutex;
+    std::condition_variable readyCv;
+    std::mutex admitMutex;            // Guards admitted, deferred and DirNode::deferredSlot
+    const size_t admitLimit;          // Directories that may be started but not yet printed
+    size_t admitted = 0;              // Directories started and not yet printed
+    std::vector<DirNode*> deferred;   // Subdirectories waiting for admission
+    std::mutex spareMutex;                                     // Guards spareListings
+    std::vector<std::unique_ptr<DirectoryListing>> spareListings; // Printed listings, ready for reuse
+};
+
+// Streaming output for --stream
+// Entries are printed in the order the scanner returns them, without collecting or sorting
+// anything, so memory use does not depend on the size of a directory. For -r every
+// directory is read twice: once to print its entries and once more to descend into its
+// subdirectories, remembering only the resume position of each open level.
+class StreamListing {
+public:
+    explicit StreamListing(const ListOptions& options) : options(options) {
+        if (options.showTotalSize && !options.recursive) pool = std::make_unique<WorkStealingPool>(options.jobs);
+        wide = wideViewForced(options);
+        columns = std::max<size_t>(1, terminalWidth() / cellWidth);
+    }
+
+    void run(const fs::path& root, Totals& totals) {
+        printDirectory(root, totals);
+        if (!options.recursive) return;
+
+        // The stack holds exactly the ancestors of the directory being printed, which is
+        // all that cycle detection needs
+        struct Level {
+            fs::path path;       // Directory being searched for subdirectories
+            off64_t resume = 0;  // Scanner position just after the last subdirectory visited
+            DirKey key;          // Identity of the directory
+        };
+        std::vector<Level> stack;
+        DirKey rootKey;
+        directoryKey(root.c_str(), rootKey);
+        if (options.maxDepth != 0) stack.push_back({root, 0, rootKey});
+
+        while (!stack.empty() && !output().closed()) {
+            fs::path child;
+            if (!nextSubdirectory(stack.back().path, stack.back().resume, child)) {
+                stack.pop_back();
+                continue;
+            }
+
+            DirKey key;
+            if (directoryKey(child.c_str(), key)) {
+                if (options.oneFileSystem && key.dev != rootKey.dev) continue;
+                bool cycle = std::any_of(stack.begin(), stack.end(), [&key](const Level& level) {
+                    return level.key.dev == key.dev && level.key.ino == key.ino;
+                });
+                if (cycle) continue;
+            }
+
+            if (options.format == OutputFormat::Text) printHeader(child);
+            printDirectory(child, totals);
+            if (options.maxDepth < 0 || static_cast<int>(stack.size()) < options.maxDepth) {
+                stack.push_back({child, 0, key});
+            }
+        }
+    }
+
+private:
+    // First pass over a directory: print every matching entry as soon as it is read
+    // Reading, lookups and printing take turns for every entry, so all of it is charged to
+    // Phase::Scan (a scope per entry would cost more time than it measures)
+    void printDirectory(const fs::path& path, Totals& totals) {
+        PhaseScope phase(Phase::Scan);
+        if (!scanner.open(path.c_str())) return;
+
+        ScanEntry raw;
+        while (!output().closed() && scanner.next(raw)) {
+            if (!options.pattern.matches(raw.name, raw.nameLength)) {
+                continue;
+            }
+
+            names.reset(); // Only one entry is alive at a time
+            DirEntry entry = makeEntry(scanner.fd(), raw, names, options);
+            if (entry.isDirectory) {
+                totals.dirs++;
+                if (pool) {
+                    SizeAggregator(*pool, nullptr, options.diskUsage).run(path, &entry, 1);
+                    totals.size += entry.size;
+                }
+            } else {
+                totals.files++;
+                if (!entry.sharedLink) totals.size += entry.size;
+            }
+
+            if (options.format != OutputFormat::Text) {
+                printRecord(entry, path, options.format);
+            } else if (wide) {
+                printColumnCell(entry, fitCellName(entry.name), cellWidth);
+                if (++column == columns) endRow();
+            } else {
+                printEntry(entry, options.showTotalSize && !options.recursive);
+            }
+        }
+        scanner.close();
+        endRow();
+    }
+
+    // Second pass: find the next matching subdirectory after the resume position
+    bool nextSubdirectory(const fs::path& path, off64_t& resume, fs::path& child) {
+        PhaseScope phase(Phase::Scan);
+        if (!scanner.open(path.c_str()) || !scanner.seek(resume)) {
+            scanner.close();
+            return false;
+        }
+
+        ScanEntry raw;
+        bool found = false;
+        while (!found && scanner.next(raw)) {
+            if (!options.pattern.matches(raw.name, raw.nameLength)) {
+                continue;
+            }
+
+            bool isDirectory = (raw.type == DT_DIR);
+            struct statx info;
+            if ((raw.type == DT_LNK || raw.type == DT_UNKNOWN) && statEntry(scanner.fd(), raw.name, STATX_TYPE, info)) {
+                isDirectory = S_ISDIR(info.stx_mode); // Symlinks are followed, as in the sorted listing
+            }
+            if (isDirectory) {
+                child = path / raw.name;
+                resume = raw.offset;
+                found = true;
+            }
+        }
+        scanner.close();
+        return found;
+    }
+
+    // Finish a partly filled row of the multi-column view
+    void endRow() {
+        if (column > 0) output().endLine();
+        column = 0;
+    }
+
+    // Entries are printed before the rest of the directory is known, so cells have a fixed width
+    static constexpr size_t cellWidth = 3 + maxCellNameWidth;
+    const ListOptions& options;
+    DirectoryScanner scanner;                 // Shared by both passes and every level
+    NameArena names{4096};                    // Holds the name of the entry being printed
+    std::unique_ptr<WorkStealingPool> pool;   // Only used for -t directory totals
+    bool wide = false;                        // -w: print cells instead of list lines
+    size_t columns = 1;                       // Cells per row in the multi-column view
+    size_t column = 0;                           // Cells printed in the current row
+};
+
+// Live listing for --watch
+// The directory is listed once and then kept up to date on screen from inotify events
+// (watch.h). The entries are kept in a vector of rows in display order. A changed entry gets
+// one new statx and is moved to its new row by binary search, and only the rows between its
+// old and new position are drawn again, together with the summary, whose counters are updated
+// by the difference. Nothing is read or sorted again, so an update costs as much as what
+// changed, not as much as the directory is big. q (or Ctrl-C) ends the watch.
+class WatchListing {
+public:
+    explicit WatchListing(const ListOptions& options, Totals& totals) : options(options), totals(totals) {}
+
+    ~WatchListing() {
+        if (dirFd >= 0) ::close(dirFd);
+    }
+
+    void run(const fs::path& path) {
+        dirFd = ::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0 || !watch.open(path.c_str())) {
+            std::cerr << "Error: cannot watch " << path.native() << std::endl;
+            return;
+        }
+        load(path);
+
+        // Keys from the terminal, and a clean exit (restoring it) on Ctrl-C
+        // The signal handlers also write to a pipe that is polled with the rest, so a signal
+        // that comes just before the poll wakes it all the same, on whichever thread it lands
+        int wakePipe[2];
+        if (pipe2(wakePipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+            std::cerr << "Error: cannot watch " << path.native() << std::endl;
+            return;
+        }
+        std::unique_ptr<TerminalRawMode> rawMode;
+        if (isatty(STDIN_FILENO)) rawMode = std::make_unique<TerminalRawMode>(STDIN_FILENO);
+        stopRequested = 0;
+        resized = 0;
+        wakeFd = wakePipe[1];
+        for (int signalNumber : {SIGINT, SIGTERM, SIGHUP}) std::signal(signalNumber, requestStop);
+        std::signal(SIGWINCH, noteResize);
+
+        OutputWriter& out = output();
+        out.setLineFlush(false); // Every update goes out as one write
+        out.write("\033[?7l");  // No line wrapping, every row has to stay on its own line
+        drawAll();
+
+        bool gone = false;
+        while (!stopRequested && !gone) {
+            struct pollfd fds[3] = {{wakePipe[0], POLLIN, 0}, {watch.fd(), POLLIN, 0}, {STDIN_FILENO, POLLIN, 0}};
+            if (poll(fds, rawMode ? 3 : 2, -1) < 0) continue; // Interrupted by a signal, see the pipe
+            if (fds[0].revents & POLLIN) {
+                char drained[64];
+                while (::read(wakePipe[0], drained, sizeof drained) > 0) {
+                }
+                if (resized) {
+                    resized = 0;
+                    drawAll();
+                }
+                continue;
+            }
+            if (rawMode) {
+                // A terminal that went away reports a hangup or an error, and then nothing to read
+                if (fds[2].revents & (POLLHUP | POLLERR | POLLNVAL)) break;
+                if (fds[2].revents & POLLIN) {
+                    int key = getKeyStroke();
+                    if (key < 0 || key == 'q' || key == 'Q') break;
+                }
+            }
+            if (!(fds[1].revents & POLLIN)) continue;
+
+            // Let a burst of events settle, so that it is drawn once
+            bool overflow = false;
+            for (int round = 0; round < 10; ++round) {
+                DirectoryWatch::Result result = watch.read([this](const char* name) { changed.insert(name); });
+                overflow |= result.overflow;
+                gone |= result.gone;
+                if (!watch.wait(20)) break;
+            }
+            // The open descriptor keeps a deleted directory alive, so its own events may never come
+            struct stat own;
+            if (fstat(dirFd, &own) == 0 && own.st_nlink == 0) gone = true;
+            if (overflow) {
+                load(path); // Events were lost: start over
+                drawAll();
+                continue;
+            }
+            for (const auto& name : changed) refresh(name);
+            changed.clear();
+            drawChanges();
+        }
+
+        // Leave the cursor below the summary
+        moveTo(visibleRows() + 3);
+        out.write("\033[?7h");
+        if (gone) out.write("The directory is gone.\n");
+        out.flush();
+        for (int signalNumber : {SIGINT, SIGTERM, SIGHUP, SIGWINCH}) std::signal(signalNumber, SIG_DFL);
+        wakeFd = -1;
+        ::close(wakePipe[0]);
+        ::close(wakePipe[1]);
+    }
+
+private:
+    // An entry of the listing, with its name and sort key stored next to it
+    struct WatchedEntry {
+        std::string name;
+        DirEntry entry;        // Its name views the string above
+        std::uint8_t group = 0; // Sort key (see sortKeyParts)
+        std::uint64_t number = 0;
+        std::string text;
+    };
+
+    // Display order: the sort key, then the name itself for names that only differ in case
+    static bool rowBefore(const WatchedEntry* a, const WatchedEntry* b) {
+        if (a->group != b->group) return a->group < b->group;
+        if (a->number != b->number) return a->number < b->number;
+        if (a->text != b->text) return a->text < b->text;
+        return a->name < b->name;
+    }
+
+    // Read the whole directory (at the start, and again after lost events)
+    void load(const fs::path& path) {
+        rows.clear();
+        entries.clear();
+        totals = Totals();
+        DirectoryListing listing;
+        readDirectory(path, options, listing, totals);
+        for (auto& entry : listing.entries) {
+            finishEntry(entry);
+            auto item = std::make_unique<WatchedEntry>();
+            item->name = std::string(entry.name);
+            item->entry = entry;
+            setKey(*item);
+            rows.push_back(item.get());
+            entries.emplace(item->name, std::move(item));
+        }
+        std::sort(rows.begin(), rows.end(), rowBefore);
+    }
+
+    void setKey(WatchedEntry& item) {
+        item.entry.name = item.name;
+        SortKeyParts key = sortKeyParts(item.entry, options.sortOrder);
+        item.group = key.group;
+        if (options.sortOrder == SortOrder::None) {
+            if (item.number == 0) item.number = ++arrivals; // New entries go last
+        } else {
+            item.number = key.number;
+        }
+        item.text = sortText(item.name, key);
+    }
+
+    // Look at an entry an event was about again, and move it to its new row
+    void refresh(const std::string& name) {
+        struct statx info;
+        const unsigned int mask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | (options.sniff ? STATX_INO : 0) |
+                                   (options.diskUsage ? STATX_BLOCKS : 0);
+        bool exists = options.pattern.matches(name.c_str(), name.size()) &&
+                      (statEntry(dirFd, name.c_str(), mask, info) || statEntry(dirFd, name.c_str(), mask, info, false));
+
+        std::unique_ptr<WatchedEntry> item;
+        size_t oldRow = SIZE_MAX;
+        auto found = entries.find(name);
+        if (found != entries.end()) {
+            item = std::move(found->second);
+            entries.erase(found);
+            oldRow = rowOf(item.get());
+            rows.erase(rows.begin() + static_cast<std::ptrdiff_t>(oldRow));
+            count(item->entry, -1);
+        }
+        if (!exists) {
+            if (oldRow != SIZE_MAX) markRows(oldRow, rows.size() + 1); // Everything below moves up
+            return;
+        }
+
+        if (!item) {
+            item = std::make_unique<WatchedEntry>();
+            item->name = name;
+        }
+        item->entry = DirEntry();
+        item->entry.name = item->name;
+        applyStat(item->entry, info, options);
+        sniffEntry(dirFd, item->entry, info, options);
+        finishEntry(item->entry);
+        setKey(*item);
+
+        auto position = std::lower_bound(rows.begin(), rows.end(), item.get(), rowBefore);
+        size_t newRow = static_cast<size_t>(position - rows.begin());
+        rows.insert(position, item.get());
+        count(item->entry, 1);
+        entries.emplace(item->name, std::move(item));
+        if (oldRow == SIZE_MAX) {
+            markRows(newRow, rows.size()); // Everything below moves down
+        } else {
+            markRows(std::min(oldRow, newRow), std::max(oldRow, newRow) + 1);
+        }
+    }
+
+    size_t rowOf(const WatchedEntry* item) const {
+        return static_cast<size_t>(std::lower_bound(rows.begin(), rows.end(), item, rowBefore) - rows.begin());
+    }
+
+    // Add (sign 1) or take back (sign -1) an entry in the summary counters
+    void count(const DirEntry& entry, int sign) {
+        if (entry.isDirectory) {
+            totals.dirs += sign;
+        } else {
+            totals.files += sign;
+            totals.size = sign > 0 ? totals.size + entry.size : totals.size - entry.size;
+        }
+    }
+
+    void markRows(size_t first, size_t last) {
+        dirtyFirst = std::min(dirtyFirst, first);
+        dirtyLast = std::max(dirtyLast, last);
+    }
+
+    // Rows of the screen for entries; the summary takes the two lines below them
+    size_t visibleRows() const { return static_cast<size_t>(std::max(screenHeight() - 3, 1)); }
+
+    static int screenHeight() {
+        struct winsize w = {};
+        ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
+        return w.ws_row > 0 ? w.ws_row : 24;
+    }
+
+    void moveTo(size_t line) {
+        char text[32] = "\033[";
+        char* end = std::to_chars(text + 2, text + sizeof(text), line).ptr;
+        std::memcpy(end, ";1H", 3);
+        output().write(text, static_cast<size_t>(end + 3 - text));
+    }
+
+    // Draw screen rows [first, last) again; a listing longer than the screen ends with a "more" row
+    void drawRows(size_t first, size_t last) {
+        OutputWriter& out = output();
+        size_t visible = visibleRows();
+        bool overflow = rows.size() > visible;
+        size_t shown = overflow ? visible - 1 : rows.size();
+        last = std::min(last, visible);
+        for (size_t row = first; row < last; ++row) {
+            moveTo(row + 1);
+            out.write("\033[2K");
+            if (row < shown) {
+                printEntry(rows[row]->entry, false);
+            } else if (overflow && row == visible - 1) {
+                char more[24];
+                out.write("   ... ");
+                out.write(more, static_cast<size_t>(std::to_chars(more, more + sizeof(more), rows.size() - shown).ptr - more));
+                out.write(" more");
+            }
+        }
+    }
+
+    void drawSummary() {
+        moveTo(visibleRows() + 1);
+        output().write("\033[J"); // Clear the old summary
+        displaySummary(totals.files, totals.dirs, totals.size);
+    }
+
+    void drawAll() {
+        output().write("\033[H\033[2J");
+        drawRows(0, visibleRows());
+        drawSummary();
+        output().flush();
+        dirtyFirst = SIZE_MAX;
+        dirtyLast = 0;
+        wasOverflowing = rows.size() > visibleRows();
+    }
+
+    // Draw the rows that changed since the last update, and the summary
+    void drawChanges() {
+        size_t visible = visibleRows();
+        if (dirtyFirst < dirtyLast) drawRows(dirtyFirst, dirtyLast);
+        bool overflow = rows.size() > visible;
+        if (overflow || wasOverflowing) drawRows(visible - 1, visible); // The "more" row counts everything below
+        wasOverflowing = overflow;
+        drawSummary();
+        output().flush();
+        dirtyFirst = SIZE_MAX;
+        dirtyLast = 0;
+    }
+
+    static void requestStop(int) {
+        stopRequested = 1;
+        wake();
+    }
+
+    static void noteResize(int) {
+        resized = 1;
+        wake();
+    }
+
+    // Make the poll of run() return (from a signal handler, so only write() and errno)
+    static void wake() {
+        int savedErrno = errno;
+        if (wakeFd >= 0 && ::write(wakeFd, "", 1) < 0) {
+            // Full: the poll has a wakeup waiting already
+        }
+        errno = savedErrno;
+    }
+
+    static inline volatile std::sig_atomic_t stopRequested = 0;
+    static inline volatile std::sig_atomic_t resized = 0;
+    static inline volatile std::sig_atomic_t wakeFd = -1; // Write end of the pipe of run()
+
+    const ListOptions& options;
+    Totals& totals;                 // Summary counters, kept up to date
+    int dirFd = -1;                 // The watched directory, for the statx of changed entries
+    DirectoryWatch watch;
+    std::vector<WatchedEntry*> rows; // Entries in display order
+    std::unordered_map<std::string_view, std::unique_ptr<WatchedEntry>> entries; // By name
+    std::unordered_set<std::string> changed; // Names events were about, since the last update
+    std::uint64_t arrivals = 0;     // Entries seen so far, the order of --sort=none
+    size_t dirtyFirst = SIZE_MAX;   // Rows to draw again: [dirtyFirst, dirtyLast)
+    size_t dirtyLast = 0;
+    bool wasOverflowing = false;    // The last update ended with a "more" row
+};
+
+// Print one line of --top: the size, then the path in the colors of its type
+void printTopItem(const TopItem& item, const ListOptions& options) {
+    DirEntry entry;
+    entry.name = item.path;
+    entry.isDirectory = S_ISDIR(item.mode);
+    entry.isRegularFile = S_ISREG(item.mode);
+    entry.mode = item.mode;
+    entry.size = item.size;
+    size_t slash = item.path.rfind('/');
+    entry.isHidden = item.path[slash == std::string::npos ? 0 : slash + 1] == '.';
+    entry.type = entry.isDirectory ? FileType::Other : categorizeFile(entry);
+
+    if (options.format != OutputFormat::Text) {
+        printRecord(entry, fs::path(), options.format); // The path is already complete
+        return;
+    }
+    const RenderTable& render = renderTable();
+    OutputWriter& out = output();
+    char sizeText[sizeTextCapacity];
+    out.write(render.style(entry.type, entry.isDirectory, entry.isHidden).listPrefix());
+    out.pad(std::string_view(sizeText, formatSizeTo(sizeText, item.size)), 10);
+    out.put(' ');
+    out.write(item.path);
+    out.write(render.reset);
+    out.endLine();
+}
+
+// --top: walk the whole tree once and print only its largest files and directories
+// The walk is the one of -t (SizeAggregator), which keeps the N largest of each on the side;
+// the pattern narrows down the files, the summary covers the whole tree.
+// With several directories, the largest of all of them are shown.
+void listLargest(const std::vector<fs::path>& roots, const ListOptions& options, Totals& totals) {
+    WorkStealingPool pool(options.jobs);
+    SizeAggregator aggregator(pool, options.index, options.diskUsage);
+    aggregator.collectTop(options.top, options.pattern);
+    for (const auto& root : roots) totals.size += aggregator.total(root);
+    TopSizes top = aggregator.takeTop();
+    totals.files = top.fileCount;
+    totals.dirs = top.directoryCount;
+
+    PhaseScope phase(Phase::Render);
+    std::vector<TopItem> files = top.files.take();
+    std::vector<TopItem> directories = top.directories.take();
+    bool text = options.format == OutputFormat::Text;
+    OutputWriter& out = output();
+    if (text) {
+        out.write("Largest files:");
+        out.endLine();
+    }
+    for (const auto& item : files) printTopItem(item, options);
+    if (text) {
+        out.endLine();
+        out.write("Largest directories:");
+        out.endLine();
+    }
+    for (const auto& item : directories) printTopItem(item, options);
+}
+
+// A directory to list: as given (for the output), and its canonical path
+struct ListedRoot {
+    fs::path path;
+    std::string canonical;
+};
+
+// List the contents of one directory, without -r
+// With -t, the aggregator measures its subdirectories (the one aggregator, and its pool, is
+// shared by all listed directories).
+void listDirectory(const ListedRoot& root, const ListOptions& options, Totals& totals, SizeAggregator* aggregator) {
+    const fs::path& path = root.path;
+    DirectoryListing listing; // Sorted directories and files
+    readDirectory(path, options, listing, totals);
+    size_t ordered = sortListing(listing, options, firstScreen(options));
+
+    if (options.showTotalSize) {
+        // Calculate directory sizes only if -t is used and -r is NOT used
+        aggregator->run(root.canonical, listing.entries.data(), listing.directoryCount);
+        for (const auto& dir : listing.directories()) {
+            totals.size += dir.size; // Add directory size to total
+        }
+        if (options.sortOrder == SortOrder::Size) {
+            // Only now are the directory sizes known
+            sortEntries(listing.entries.data(), listing.directoryCount, SortOrder::Size, SIZE_MAX, options.jobs);
+            ordered = std::max(ordered, listing.directoryCount);
+        }
+    }
+
+    size_t count = listing.entries.size();
+    if (ordered < count) {
+        // Show the first screen, then sort the rest
+        DirEntry* rest = listing.entries.data() + ordered;
+        displayDirectory(path, EntryRange{listing.entries.data(), ordered}, options);
+        output().flush();
+        sortEntries(rest, count - ordered, options.sortOrder, SIZE_MAX, options.jobs);
+        displayDirectory(path, EntryRange{rest, count - ordered}, options);
+    } else {
+        displayDirectory(path, listing.all(), options);
+    }
+}
+
+// List the contents of every directory to list (see listedRoots), each after a "path:" line
+// when there are several. Recursive listings of all of them share one traversal pool, and so
+// do the -t totals.
+void listDirectoryContents(const std::vector<ListedRoot>& roots, const ListOptions& options, Totals& totals) {
+    std::vector<fs::path> paths;
+    for (const auto& root : roots) paths.push_back(root.path);
+
+    if (options.top > 0) {
+        listLargest(paths, options, totals);
+        return;
+    }
+
+    if (options.watch) {
+        WatchListing(options, totals).run(paths.front());
+        return;
+    }
+
+    if (options.recursive && !options.stream) {
+        RecursiveListing listing(options);
+        totals.merge(listing.run(paths));
+        return;
+    }
+
+    bool headers = roots.size() > 1 && options.format == OutputFormat::Text;
+    if (options.stream) {
+        StreamListing listing(options);
+        for (size_t i = 0; i < roots.size() && !output().closed(); ++i) {
+            if (headers) printHeader(roots[i].path, i > 0);
+            listing.run(roots[i].path, totals);
+        }
+        return;
+    }
+
+    std::unique_ptr<WorkStealingPool> pool;
+    std::unique_ptr<SizeAggregator> aggregator;
+    if (options.showTotalSize) {
+        pool = std::make_unique<WorkStealingPool>(options.jobs);
+        aggregator = std::make_unique<SizeAggregator>(*pool, options.index, options.diskUsage);
+        if (roots.size() > 1) {
+            std::vector<std::string> listed;
+            for (const auto& root : roots) listed.push_back(root.canonical);
+            aggregator->shareTotals(listed);
+        }
+    }
+    for (size_t i = 0; i < roots.size() && !output().closed(); ++i) {
+        if (headers) printHeader(roots[i].path, i > 0);
+        listDirectory(roots[i], options, totals, aggregator.get());
+    }
+}
+
+// List the contents of a single directory
+void listDirectoryContents(const fs::path& path, const ListOptions& options, Totals& totals) {
+    listDirectoryContents(std::vector<ListedRoot>{{path, path.string()}}, options, totals);
 }
 
 // Display an error message and usage instructions
@@ -353,10 +2115,51 @@ bool directoryExists(const std::string& path) {
     return std::filesystem::exists(path) && std::filesystem::is_directory(path);
 }
 
+// Recognize a flag that takes a value ("-j 4", "-j4", "--jobs 4" or "--jobs=4")
+// The flag is stored as "--name=value" so main() only has to handle one form
+bool parseValueFlag(const std::string& arg, const std::string& shortName, const std::string& longName,
+    int argc, char* argv[], int& i, std::vector<std::string>& flags) {
+    std::string value;
+    if (arg == shortName || arg == longName) {
+        if (i + 1 >= argc) showError("Missing value for " + arg);
+        value = argv[++i];
+    } else if (arg.rfind(longName + "=", 0) == 0) {
+        value = arg.substr(longName.size() + 1);
+    } else if (!shortName.empty() && arg.size() > shortName.size() && arg.rfind(shortName, 0) == 0) {
+        value = arg.substr(shortName.size());
+    } else {
+        return false;
+    }
+    flags.push_back(longName + "=" + value);
+    return true;
+}
+
+// Parse a number given to a value flag (positive and at most 4096 unless told otherwise)
+unsigned parseCount(const std::string& flag, const std::string& value, unsigned long minimum = 1,
+    unsigned long maximum = 4096) {
+    char* end = nullptr;
+    unsigned long count = std::strtoul(value.c_str(), &end, 10);
+    if (value.empty() || value[0] == '-' || *end != '\0' || count < minimum || count > maximum) {
+        showError("Invalid value for " + flag + ": " + value);
+    }
+    return static_cast<unsigned>(count);
+}
+
+// Parse the key given to --sort
+SortOrder parseSortOrder(const std::string& key) {
+    if (key == "type") return SortOrder::Type;
+    if (key == "name") return SortOrder::Name;
+    if (key == "size") return SortOrder::Size;
+    if (key == "mtime") return SortOrder::Mtime;
+    if (key == "ext") return SortOrder::Extension;
+    if (key == "none") return SortOrder::None;
+    showError("Invalid value for --sort: " + key);
+    return SortOrder::Type;
+}
+
 // Parse command-line arguments and handle errors
-void parseTargets(int argc, char* argv[], std::string& dir, std::string& pattern, std::vector<std::string>& flags) {
-    dir = ".";      // Default directory
-    pattern = "*";  // Default pattern (match everything)
+void parseTargets(int argc, char* argv[], std::vector<std::string>& dirs, std::vector<std::string>& patterns,
+    std::vector<std::string>& flags) {
 
     if (argc == 1) {
         // If no arguments are provided, assume default behavior (like 'ls')
@@ -374,60 +2177,249 @@ void parseTargets(int argc, char* argv[], std::string& dir, std::string& pattern
             else if (arg == "-w" || arg == "--wide") flags.push_back(arg);
             else if (arg == "-p" || arg == "--pause") flags.push_back(arg);
             else if (arg == "-h" || arg == "--help") flags.push_back(arg);
+            else if (arg == "--stream") flags.push_back(arg);
+            else if (arg == "--watch") flags.push_back(arg);
+            else if (arg == "--sniff") flags.push_back(arg);
+            else if (arg == "--disk-usage") flags.push_back(arg);
+            else if (arg == "-x" || arg == "--one-file-system") flags.push_back(arg);
+            else if (arg == "--json") flags.push_back(arg);
+            else if (arg == "--stats") flags.push_back(arg);
+            else if (arg == "--bench-micro") flags.push_back(arg);
+            else if (arg == "--check") flags.push_back(arg);
+            else if (arg == "--color") flags.push_back("--color=always");
+            else if (arg == "-0" || arg == "--null") flags.push_back(arg);
+            else if (parseValueFlag(arg, "-j", "--jobs", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--index", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--max-depth", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--top", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--sort", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--head", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--bench", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--bench-scale", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--color", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--queue-depth", argc, argv, i, flags)) continue;
+            else if (parseValueFlag(arg, "", "--batch", argc, argv, i, flags)) continue;
             else showError("Unknown flag: " + arg);
         } else if (arg.find('*') != std::string::npos || arg.find('?') != std::string::npos) { 
-            // Handle patterns with wildcards
-            if (pattern == "*") pattern = arg;
-            else showError("Multiple patterns are not allowed.");
+            // Handle patterns with wildcards (an entry has to match one of them)
+            patterns.push_back(arg);
         } else { 
             // Handle directory or file path
-            if (dir == ".") dir = arg;
-            else showError("Multiple directories are not allowed.");
+            dirs.push_back(arg);
         }
     }
 
-    // Validate the provided directory
-    if (!directoryExists(dir)) {
-        showError("Directory does not exist: " + dir);
+    // Validate the provided directories
+    for (const auto& dir : dirs) {
+        if (!directoryExists(dir)) showError("Directory does not exist: " + dir);
+    }
+}
+
+// --batch: add the directories listed in a file ("-" for stdin), one per line
+// Empty lines are skipped; lines that are not directories are reported and skipped, so one
+// stale line does not stop a whole batch. Returns false if any line was skipped.
+bool readBatch(const std::string& source, std::vector<std::string>& dirs) {
+    std::ifstream file;
+    if (source != "-") {
+        file.open(source);
+        if (!file) showError("Cannot read batch file: " + source);
+    }
+    std::istream& in = source == "-" ? std::cin : file;
+    bool complete = true;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (line.empty()) continue;
+        if (!directoryExists(line)) {
+            std::cerr << "Warning: not a directory, skipped: " << line << std::endl;
+            complete = false;
+            continue;
+        }
+        dirs.push_back(line);
     }
+    return complete;
+}
+
+// Canonical form of a directory path, for telling whether two listed directories overlap
+std::string canonicalPath(const std::string& path) {
+    char* resolved = realpath(path.c_str(), nullptr);
+    if (!resolved) return path;
+    std::string canonical(resolved);
+    std::free(resolved);
+    return canonical;
+}
+
+// The directories to list, in the order given, each only once
+// A directory that was given before (under any name) is dropped. So is one inside another
+// listed directory whose listing covers it anyway: with --top, or -r without --max-depth
+// (unless -x keeps that listing from crossing into its file system). The -t totals of
+// overlapping directories are shared instead (see SizeAggregator::shareTotals).
+std::vector<ListedRoot> listedRoots(const std::vector<std::string>& dirs, const ListOptions& options) {
+    std::vector<ListedRoot> roots;
+    std::unordered_set<std::string> seen;
+    for (const auto& dir : dirs) {
+        ListedRoot root{dir, canonicalPath(dir)};
+        if (seen.insert(root.canonical).second) roots.push_back(std::move(root));
+    }
+    bool coversSubtrees = options.top > 0 || (options.recursive && options.maxDepth < 0);
+    if (!coversSubtrees || roots.size() < 2) return roots;
+
+    auto device = [](const std::string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0 ? info.st_dev : 0;
+    };
+    std::vector<ListedRoot> kept;
+    for (auto& root : roots) {
+        // Look for a listed ancestor, one path component at a time
+        bool covered = false;
+        std::string ancestor = root.canonical;
+        while (!covered && ancestor.size() > 1) {
+            size_t slash = ancestor.rfind('/');
+            ancestor.resize(slash == 0 ? 1 : slash);
+            covered = seen.count(ancestor) > 0 &&
+                      (!options.oneFileSystem || options.top > 0 || device(ancestor) == device(root.canonical));
+        }
+        if (!covered) kept.push_back(std::move(root));
+    }
+    return kept;
 }
 
 // Main function
 int main(int argc, char* argv[]) {
     // Detect terminal height
-    struct winsize w;
+    struct winsize w = {};
     ioctl(STDOUT_FILENO, TIOCGWINSZ, &w);
     int screenHeight = w.ws_row > 0 ? w.ws_row : 24; // Default to 24 if detection fails
 
-    std::string dir, pattern;
+    std::vector<std::string> dirs, patterns;
     std::vector<std::string> flags;
 
-    parseTargets(argc, argv, dir, pattern, flags);
+    parseTargets(argc, argv, dirs, patterns, flags);
 
     // Initialize feature variables based on flags
-    bool recursive = false, showTotalSize = false, forceList = false, forceWide = false, screenPause = false;
+    ListOptions options;
+    DirectoryIndex index; // Only used with --index
+    options.pattern.compile(patterns); // Compiled once, evaluated for every entry
+    options.screenHeight = screenHeight;
+    options.jobs = std::max(1u, std::thread::hardware_concurrency()); // Default to one thread per core
+    bool screenPause = false;
+    bool showStats = false;     // --stats: report phase times and counters at the end
+    std::string benchDirectory; // --bench: run the benchmark there instead of listing
+    unsigned benchScale = 1;
+    bool microBench = false;    // --bench-micro: time single functions instead of listing
+    bool selfCheck = false;     // --check: run the self-checks instead of listing
+    std::string colorMode = "auto"; // --color: auto, always or never
+    std::string batchSource;        // --batch: file (or "-" for stdin) with more directories to list
 
     for (const auto& flag : flags) {
-        if (flag == "-r" || flag == "--recursive") recursive = true;
-        else if (flag == "-t" || flag == "--total") showTotalSize = true;
-        else if (flag == "-l" || flag == "--list") forceList = true;
-        else if (flag == "-w" || flag == "--wide") forceWide = true;
+        if (flag == "-r" || flag == "--recursive") options.recursive = true;
+        else if (flag == "-t" || flag == "--total") options.showTotalSize = true;
+        else if (flag == "-l" || flag == "--list") options.forceList = true;
+        else if (flag == "-w" || flag == "--wide") options.forceWide = true;
         else if (flag == "-p" || flag == "--pause") screenPause = true;
+        else if (flag == "--stream") options.stream = true;
+        else if (flag == "--watch") options.watch = true;
+        else if (flag == "--sniff") options.sniff = true;
+        else if (flag == "--disk-usage") options.diskUsage = true;
+        else if (flag == "-x" || flag == "--one-file-system") options.oneFileSystem = true;
+        else if (flag == "--json") options.format = OutputFormat::Json;
+        else if (flag == "--stats") showStats = true;
+        else if (flag == "--bench-micro") microBench = true;
+        else if (flag == "--check") selfCheck = true;
+        else if (flag == "-0" || flag == "--null") options.format = OutputFormat::NullSeparated;
+        else if (flag.rfind("--color=", 0) == 0) colorMode = flag.substr(8);
+        else if (flag.rfind("--bench=", 0) == 0) benchDirectory = flag.substr(8);
+        else if (flag.rfind("--bench-scale=", 0) == 0) benchScale = parseCount("--bench-scale", flag.substr(14), 1, 1000);
+        else if (flag.rfind("--max-depth=", 0) == 0) options.maxDepth = parseCount("--max-depth", flag.substr(12), 0, 1000000);
+        else if (flag.rfind("--top=", 0) == 0) options.top = parseCount("--top", flag.substr(6), 1, 1000000);
+        else if (flag.rfind("--head=", 0) == 0) options.head = parseCount("--head", flag.substr(7), 1, 100000000);
+        else if (flag.rfind("--sort=", 0) == 0) options.sortOrder = parseSortOrder(flag.substr(7));
+        else if (flag.rfind("--queue-depth=", 0) == 0) {
+            metadataQueueDepth = parseCount("--queue-depth", flag.substr(14));
+            metadataQueueAuto = false;
+        }
+        else if (flag.rfind("--jobs=", 0) == 0) options.jobs = parseCount("--jobs", flag.substr(7));
+        else if (flag.rfind("--batch=", 0) == 0) batchSource = flag.substr(8);
+        else if (flag.rfind("--index=", 0) == 0) {
+            index.open(flag.substr(8));
+            options.index = &index;
+        }
         else if (flag == "-h" || flag == "--help") {
             showAboutScreen();
             return 0;
         }
     }
 
+    // Colors by default only on a terminal, and not when NO_COLOR is set (https://no-color.org)
+    if (colorMode == "auto") {
+        const char* noColor = std::getenv("NO_COLOR");
+        colorOutput = isatty(STDOUT_FILENO) && !(noColor && *noColor);
+    } else if (colorMode == "always" || colorMode == "never") {
+        colorOutput = colorMode == "always";
+    } else {
+        showError("Invalid value for --color: " + colorMode);
+    }
+
+    if (!benchDirectory.empty()) {
+        return runBenchmarks(benchDirectory, benchScale, options);
+    }
+    if (microBench) return runMicroBenchmarks(benchScale);
+    if (selfCheck) return runSelfChecks();
+
+    // The directories to list: those given, those of the --batch, or the current one
+    bool batchComplete = batchSource.empty() || readBatch(batchSource, dirs);
+    if (dirs.empty() && batchSource.empty()) dirs.push_back(".");
+    std::vector<ListedRoot> roots = listedRoots(dirs, options);
+
+    // The records of the --index keep file sizes, not the blocks --disk-usage counts
+    if (options.diskUsage && options.index) showError("--disk-usage can't be combined with --index");
+
+    // --watch redraws a screen in place: one directory, text on a terminal
+    if (options.watch) {
+        if (options.recursive || options.stream || options.top || options.showTotalSize || screenPause) {
+            showError("--watch can't be combined with -r, -t, -p, --stream or --top");
+        }
+        if (options.format != OutputFormat::Text || !isatty(STDOUT_FILENO)) showError("--watch needs a terminal");
+        if (roots.size() != 1) showError("--watch shows a single directory");
+    }
+
+    // Write line by line only when someone is watching the output as it arrives
+    output().setLineFlush(screenPause || isatty(STDOUT_FILENO));
+
+    // Page the output when asked to, as long as there is a terminal to page on
+    std::unique_ptr<Pager> pager;
+    if (screenPause && options.format == OutputFormat::Text && isatty(STDOUT_FILENO)) {
+        pager = std::make_unique<Pager>(screenHeight, static_cast<int>(terminalWidth()));
+        if (pager->active()) {
+            output().setPageSink(pager.get());
+            options.paged = true;
+        }
+    }
+
     // Initialize counters
-    int totalFiles = 0, totalDirs = 0;
-    std::uintmax_t totalSizeShown = 0;
+    Totals totals;
+    RunStats stats; // Only used with --stats
+    if (showStats) stats.start();
 
-    // List files in the specified directory
-    listDirectoryContents(dir, pattern, recursive, showTotalSize, forceList, forceWide, totalFiles, totalDirs, totalSizeShown, screenHeight);
+    // List files in the specified directories
+    if (!roots.empty()) listDirectoryContents(roots, options, totals);
 
-    // Display summary
-    displaySummary(totalFiles, totalDirs, totalSizeShown);
+    // Display summary (not part of the machine-readable formats, and already on screen with --watch)
+    if (options.format == OutputFormat::Text && !options.watch) {
+        PhaseScope phase(Phase::Summary);
+        displaySummary(totals.files, totals.dirs, totals.size);
+    }
+    // Also after q was pressed in the pager: then the listing stopped early and its output was
+    // dropped, but the terminal is restored here and the index and statistics still written
+    output().flush();
+    if (pager) {
+        pager->finish();
+        output().setPageSink(nullptr);
+    }
+    if (showStats) stats.report();
+
+    if (options.index && !index.save()) {
+        std::cerr << "Warning: could not write index file" << std::endl;
+    }
 
-    return 0;
+    return batchComplete ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,162 @@
+// format.h 🐧
+//
+// Allocation-free formatting of sizes and timestamps for ColorDir.
+// Everything is written into small caller-provided buffers with std::to_chars and integer
+// arithmetic, so printing an entry never builds a temporary std::string. Timestamps reuse
+// the broken-down date of the previous call while consecutive mtimes fall on the same
+// local day, so localtime_r (which takes a lock inside glibc) runs about once per day of
+// mtimes instead of once per line.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+
+// Large enough for any formatSizeTo result ("1023 B", "16.00 EB", ...)
+constexpr size_t sizeTextCapacity = 16;
+
+// Format a size with binary units and 4 significant digits: "512 B", "4.883 KB", "12.50 MB"
+// The value is rounded to the nearest last digit; a result that rounds up to 1024 moves on to
+// the next unit ("1.000 MB" rather than "1024 KB"). Returns the number of characters written.
+size_t formatSizeTo(char* buffer, std::uintmax_t size) {
+    char* end = buffer + sizeTextCapacity;
+    if (size < 1024) {
+        char* p = std::to_chars(buffer, end, size).ptr;
+        std::memcpy(p, " B", 2);
+        return static_cast<size_t>(p + 2 - buffer);
+    }
+
+    static const char* const units[] = {"KB", "MB", "GB", "TB", "PB", "EB", "ZB", "YB"};
+    unsigned unit = 0;
+    unsigned __int128 divisor = 1024;
+    while (size / divisor >= 1024) {
+        divisor *= 1024;
+        unit++;
+    }
+
+    // Find the most decimals that keep the rounded value at 4 digits
+    unsigned decimals = 3;
+    unsigned __int128 scaled = 0;
+    unsigned __int128 power = 1000;
+    while (true) {
+        scaled = (static_cast<unsigned __int128>(size) * power + divisor / 2) / divisor;
+        if (scaled < 10000 || decimals == 0) break;
+        decimals--;
+        power /= 10;
+    }
+    if (decimals == 0 && scaled >= 1024) {
+        // Rounded up to a whole unit of the next size: 1.000 of that
+        unit++;
+        scaled = 1000;
+        decimals = 3;
+        power = 1000;
+    }
+
+    auto value = static_cast<unsigned long long>(scaled);
+    auto whole = static_cast<unsigned long long>(scaled / power);
+    char* p = std::to_chars(buffer, end, whole).ptr;
+    if (decimals > 0) {
+        *p++ = '.';
+        unsigned long long fraction = value - whole * static_cast<unsigned long long>(power);
+        for (unsigned i = decimals; i-- > 0;) {
+            p[i] = static_cast<char>('0' + fraction % 10);
+            fraction /= 10;
+        }
+        p += decimals;
+    }
+    *p++ = ' ';
+    std::memcpy(p, units[unit], 2);
+    return static_cast<size_t>(p + 2 - buffer);
+}
+
+// Large enough for a formatted timestamp: "2025-05-20 14:03:59"
+constexpr size_t timestampTextCapacity = 20;
+
+// Formats mtimes as local "YYYY-MM-DD HH:MM:SS"
+// The date text and the start of its day are cached; a time inside the cached day only needs
+// its seconds since midnight split into hours, minutes and seconds. A day in which the UTC
+// offset changes (daylight saving) is never cached, so those times always go to localtime_r.
+class TimestampFormatter {
+public:
+    TimestampFormatter() { tzset(); }
+
+    // Write the timestamp of t into buffer, returns the number of characters (always 19)
+    size_t format(char* buffer, time_t t) {
+        if (t < dayStart || t >= dayEnd) {
+            struct tm local;
+            if (!localtime_r(&t, &local)) {
+                std::memcpy(buffer, "0000-00-00 00:00:00", 19);
+                return 19;
+            }
+            cacheDay(t, local);
+            if (t < dayStart || t >= dayEnd) {
+                // Not cacheable: format this time directly
+                writeDate(buffer, local);
+                writeClock(buffer + 11, local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec);
+                return 19;
+            }
+        }
+        std::memcpy(buffer, date, 11);
+        writeClock(buffer + 11, static_cast<int>(t - dayStart));
+        return 19;
+    }
+
+private:
+    // Remember the day of t, unless its UTC offset changes within the day
+    void cacheDay(time_t t, const struct tm& local) {
+        dayStart = dayEnd = 0;
+        time_t start = t - (local.tm_hour * 3600 + local.tm_min * 60 + local.tm_sec);
+        time_t end = start + 86400;
+        struct tm first, last;
+        if (!localtime_r(&start, &first) || !localtime_r(&end, &last)) return;
+        if (first.tm_gmtoff != local.tm_gmtoff || first.tm_hour != 0 || first.tm_min != 0 ||
+            first.tm_sec != 0 || last.tm_gmtoff != local.tm_gmtoff || last.tm_mday == first.tm_mday) {
+            return;
+        }
+        dayStart = start;
+        dayEnd = end;
+        writeDate(date, local);
+    }
+
+    // "YYYY-MM-DD " (the space included)
+    static void writeDate(char* p, const struct tm& local) {
+        int year = local.tm_year + 1900;
+        if (year < 0 || year > 9999) year = 0;
+        for (int i = 3; i >= 0; --i) {
+            p[i] = static_cast<char>('0' + year % 10);
+            year /= 10;
+        }
+        p[4] = '-';
+        writeTwoDigits(p + 5, local.tm_mon + 1);
+        p[7] = '-';
+        writeTwoDigits(p + 8, local.tm_mday);
+        p[10] = ' ';
+    }
+
+    // "HH:MM:SS"
+    static void writeClock(char* p, int secondsOfDay) {
+        writeTwoDigits(p, secondsOfDay / 3600);
+        p[2] = ':';
+        writeTwoDigits(p + 3, secondsOfDay / 60 % 60);
+        p[5] = ':';
+        writeTwoDigits(p + 6, secondsOfDay % 60);
+    }
+
+    static void writeTwoDigits(char* p, int value) {
+        p[0] = static_cast<char>('0' + value / 10 % 10);
+        p[1] = static_cast<char>('0' + value % 10);
+    }
+
+    time_t dayStart = 0;   // Cached day: [dayStart, dayEnd)
+    time_t dayEnd = 0;
+    char date[11] = {};    // "YYYY-MM-DD " of the cached day
+};
+
+#endif // FORMAT_H
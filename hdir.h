@@ -16,21 +16,28 @@
 #include <iomanip>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <filesystem>
 #include <chrono>
 #include <ctime>
+#include <cstdint>
+#include <cerrno>
 #include <fnmatch.h>
 #include <sys/stat.h>
 #include <algorithm>
 #include <termios.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include "scan.h"
+#include "out.h"
+#include "match.h"
+#include "format.h"
 
 namespace fs = std::filesystem;
 
 // Enumeration for file types
 // Used to categorize files based on their extensions or attributes
-enum class FileType {
+enum class FileType : std::uint8_t {
     Programming,  // Source code or programming-related files
     Text,         // Text documents or configuration files
     Video,        // Video files
@@ -41,16 +48,92 @@ enum class FileType {
     Other         // Files that do not fit into the above categories
 };
 
+// A directory entry as produced by the scanner
+// Type information comes from d_type; the stat fields are only filled when hasStat is set,
+// from a single statx that every consumer (printEntry, getPermissions, categorizeFile) shares.
+// Everything sorting and rendering needs is computed once when the entry is built.
+// The name is stored in the NameArena of the listing (arena.h); the full path is only
+// built where it is needed, as parent / name.
+struct DirEntry {
+    std::string_view name;         // File name without the directory part (NUL-terminated)
+    FileType type = FileType::Other; // Category from categorizeFile (Other for directories)
+    bool isHidden = false;         // Name starts with a dot
+    bool isDirectory = false;      // Directory (symlinks are followed, like std::filesystem)
+    bool isRegularFile = false;    // Regular file (symlinks are followed)
+    bool hasStat = false;          // True when the statx fields below were fetched
+    bool sharedLink = false;       // --disk-usage: a hard link whose file was counted through another link
+    mode_t mode = 0;               // File type and permission bits
+    FileType content = FileType::Other; // Category sniffed from the first bytes (--sniff), Other if unknown
+    std::uintmax_t size = 0;       // File size in bytes (allocated with --disk-usage), or the subtree total of a directory with -t
+    time_t mtime = 0;              // Last modification time
+};
+
+class DirectoryIndex; // Persistent directory index (index.h)
+
+// How entries are written (see record.h for the machine-readable formats)
+enum class OutputFormat {
+    Text,          // Colored list or multi-column view
+    Json,          // --json: one JSON object per line
+    NullSeparated  // -0: full paths terminated by NUL
+};
+
+// Order of the entries within a listing (--sort); directories always come before files
+enum class SortOrder {
+    Type,      // Files by category, then by name (the default)
+    Name,      // By name (case-insensitive)
+    Size,      // Largest first (directories too, once -t has measured them)
+    Mtime,     // Newest first
+    Extension, // By extension, then by name
+    None       // In the order the directory returns them
+};
+
+// Options that control how directories are listed
+struct ListOptions {
+    PatternMatcher pattern;        // Compiled wildcard pattern that entries must match
+    bool recursive = false;        // -r: descend into subdirectories
+    bool showTotalSize = false;    // -t: show the total size of directories
+    bool forceList = false;        // -l: always use the detailed list view
+    bool forceWide = false;        // -w: always use the multi-column view
+    int screenHeight = 24;         // Terminal height, used to choose between list and wide view
+    unsigned jobs = 1;             // -j: number of threads used by recursive listing and -t
+    bool stream = false;           // --stream: print entries as they are read, unsorted
+    DirectoryIndex* index = nullptr; // --index: persistent cache of directory contents
+    int maxDepth = -1;             // --max-depth: levels descended below the directory (-1: no limit)
+    bool oneFileSystem = false;    // -x: do not descend into directories on other file systems
+    OutputFormat format = OutputFormat::Text; // --json / -0: machine-readable output
+    size_t top = 0;                // --top: only show the N largest files and directories (0: off)
+    SortOrder sortOrder = SortOrder::Type; // --sort: order of the entries
+    size_t head = 0;               // --head: show at most N entries per directory (0: all)
+    bool paged = false;            // -p on a terminal: the output goes through the pager
+    bool watch = false;            // --watch: keep the listing on screen and up to date
+    bool sniff = false;            // --sniff: categorize files without a known extension by their content
+    bool diskUsage = false;        // --disk-usage: count allocated blocks, and hard-linked files once
+};
+
+// Counters shown in the summary line
+struct Totals {
+    int files = 0;                 // Number of files listed
+    int dirs = 0;                  // Number of directories listed
+    std::uintmax_t size = 0;       // Total size of the listed entries
+
+    // Add the counters of another traversal thread
+    void merge(const Totals& other) {
+        files += other.files;
+        dirs += other.dirs;
+        size += other.size;
+    }
+};
+
 // Function declarations
 
 // Retrieve file permissions as a string (e.g., "rwxr-xr-x")
-std::string getPermissions(const fs::path& path);
+std::string getPermissions(const DirEntry& entry);
 
 // Categorize a file based on its extension or attributes
-FileType categorizeFile(const fs::directory_entry& entry);
+FileType categorizeFile(const DirEntry& entry);
 
-// Get the appropriate color for a file type or directory
-std::string getColor(FileType type);
+// Get the appropriate color for a file type or directory (empty when colors are off)
+std::string_view getColor(FileType type, bool isDirectory = false);
 
 // Convert a filesystem time to a time_t object
 time_t to_time_t(const fs::file_time_type& ftime);
@@ -71,32 +154,19 @@ void showAboutScreen();
 void displaySummary(int totalFiles, int totalDirs, std::uintmax_t totalSizeShown);
 
 // Capture a single keypress from the user (used for pause functionality)
-char getKeyStroke();
+// Returns the byte of the key, or -1 once there is nothing more to read (the terminal is gone)
+int getKeyStroke(int fd = STDIN_FILENO);
 
 // Function implementations
 
+// Whether the listing uses colors (--color, NO_COLOR); without them no escape codes are written
+inline bool colorOutput = true;
+
 // Function to format file size into a human-readable string
+// (see formatSizeTo in format.h, which writes into a buffer instead)
 std::string formatSize(uintmax_t size) {
-    if (size < 1024) return std::to_string(size) + " B";
-    // Base units (up to YB explicitly)
-    const char* baseUnits[] = {"KB", "MB", "GB", "TB", "PB", "EB", "ZB", "YB"};
-    int unitIndex = -1;
-    double reducedSize = size;
-    // Reduce size iteratively, dynamically adding larger units if needed
-    while (reducedSize >= 1024) {
-        reducedSize /= 1024;
-        unitIndex++;
-    }
-    // If unitIndex exceeds predefined units, compute extended prefixes
-    std::string unit;
-    if (unitIndex < 7) {
-        unit = baseUnits[unitIndex];
-    } else {
-        char prefix = 'Z' + (unitIndex - 6); // Beyond ZB: [ZB, AB, BB...]
-        unit = std::string(1, prefix) + "B";
-    }
-    // Format reduced size with 4 significant digits
-    return std::to_string(reducedSize).substr(0, 5) + " " + unit;
+    char text[sizeTextCapacity];
+    return std::string(text, formatSizeTo(text, size));
 }
 
 // Function to display the about screen
@@ -126,10 +196,32 @@ void showAboutScreen() {
     std::cout << " -w, --wide       Force columns view." << std::endl;
     std::cout << " -t, --total      Display total size of directories, and subdirectories." << std::endl;
     std::cout << " -r, --recursive  Recursive listing." << std::endl;
-    std::cout << " -p, --pause      Pause after each screen of output." << std::endl;
+    std::cout << " -p, --pause      Pause after each screen of output (any key: next screen, q: quit)." << std::endl;
+    std::cout << " -j, --jobs N     Threads used by recursive listing and -t (default: one per core)." << std::endl;
+    std::cout << "     --queue-depth N  File lookups (and --sniff reads) kept in flight per thread (default: 64 on network filesystems, 1 elsewhere)." << std::endl;
+    std::cout << "     --stream     Print entries as soon as they are read (unsorted, for huge trees)." << std::endl;
+    std::cout << "     --index FILE Keep an index of scanned directories to speed up repeated -t / -r runs." << std::endl;
+    std::cout << "                  (-t and --top take file sizes from it while a directory is unchanged: a file that grew in place counts with its old size.)" << std::endl;
+    std::cout << "     --max-depth N  With -r, descend at most N levels below the directory." << std::endl;
+    std::cout << "     --sort=KEY   Sort entries by type (default), name, size, mtime, ext or none." << std::endl;
+    std::cout << "     --head N     Show at most the first N entries of every directory." << std::endl;
+    std::cout << "     --watch      Keep the listing on screen and update it as the directory changes (q: quit)." << std::endl;
+    std::cout << "     --top N      Show only the N largest files and directories of the whole tree." << std::endl;
+    std::cout << "     --batch FILE Also list the directories named in FILE, one per line (- reads them from stdin)." << std::endl;
+    std::cout << "     --disk-usage Show the space files take on disk, counting hard-linked files once in totals." << std::endl;
+    std::cout << "     --sniff      Categorize files without a known extension by their first bytes (ELF, #!, gzip, PNG, ...)." << std::endl;
+    std::cout << " -x, --one-file-system  With -r, do not descend into other file systems." << std::endl;
+    std::cout << "     --json       Print one JSON object per entry (path, type, size, mode, mtime)." << std::endl;
+    std::cout << " -0, --null       Print full paths separated by NUL characters, like find -print0." << std::endl;
+    std::cout << "     --stats      After the listing, show time per phase, system calls and peak memory." << std::endl;
+    std::cout << "     --bench DIR  Benchmark the listing on synthetic trees created in DIR." << std::endl;
+    std::cout << "     --bench-scale N  Make the benchmark trees N times smaller." << std::endl;
+    std::cout << "     --bench-micro  Time the functions every entry goes through (ns and allocations per call)." << std::endl;
+    std::cout << "     --check      Run the self-checks: no allocations while rendering, random names and headers." << std::endl;
+    std::cout << "     --color[=WHEN]  Use colors: auto (default, only on a terminal), always or never." << std::endl;
     std::cout << " -h, --help       Display this screen." << std::endl;
     std::cout << std::endl;
-    std::cout << "Usage: c [flags] [directory] [pattern, must be inside quotes \"\" and must contain at least one * or ?]" << std::endl;
+    std::cout << "Usage: c [flags] [directories] [patterns, must be inside quotes \"\" and must contain at least one * or ?]" << std::endl;
     std::cout << "Examples:" << std::endl;
     std::cout << "1. List all files in the current directory (default):       c" << std::endl;
     std::cout << "2. List all files recursively with detailed listing:        c -r -l" << std::endl;
@@ -141,33 +233,44 @@ void showAboutScreen() {
     std::cout << "8. List .config files in /etc directory recursively:        c -r /etc \"*.config\"" << std::endl;
     std::cout << "9. List all files containing an x:                          c  \"*[x]*\"" << std::endl;
     std::cout << "10. List files that do not contain a number:                c \"*[!0-9]*\"" << std::endl;
+    std::cout << "11. List the .h and .cpp files of two directories:          c src include \"*.h\" \"*.cpp\"" << std::endl;
     std::cout << "\033[0m"; // Reset to default
 }
 
 // Function to display a summary of the total files, directories, and size
 void displaySummary(int totalFiles, int totalDirs, std::uintmax_t totalSizeShown) {
-    std::string totalSummaryString = "Total: Files: " + std::to_string(totalFiles) + 
-                                     " | Dirs: " + std::to_string(totalDirs) + 
-                                     " | Size: " + formatSize(totalSizeShown) + "\n";
+    // "Total: Files: N | Dirs: N | Size: S", formatted without temporary strings
+    char files[16], dirs[16], size[sizeTextCapacity];
+    std::string_view filesText(files, std::to_chars(files, files + sizeof(files), totalFiles).ptr - files);
+    std::string_view dirsText(dirs, std::to_chars(dirs, dirs + sizeof(dirs), totalDirs).ptr - dirs);
+    std::string_view sizeText(size, formatSizeTo(size, totalSizeShown));
+    const std::string_view labels[] = {"Total: Files: ", " | Dirs: ", " | Size: "};
+    size_t length = labels[0].size() + filesText.size() + labels[1].size() + dirsText.size() +
+                    labels[2].size() + sizeText.size();
 
-    std::cout << "\033[1;33m"; // Bright Yellow
-    for (size_t i = 1; i < totalSummaryString.length(); ++i) {
-        std::cout << "─";
-    }
-    std::cout << "\033[0m" << std::endl; // ANSI Reset
-    std::cout << totalSummaryString;
+    OutputWriter& out = output();
+    if (colorOutput) out.write("\033[1;33m"); // Bright Yellow
+    out.repeat("─", length);
+    if (colorOutput) out.write("\033[0m"); // ANSI Reset
+    out.endLine();
+    out.write(labels[0]);
+    out.write(filesText);
+    out.write(labels[1]);
+    out.write(dirsText);
+    out.write(labels[2]);
+    out.write(sizeText);
+    out.put('\n');
 }
 
 // Function to capture a single keypress from the user
-char getKeyStroke() {
-    struct termios oldt, newt;
-    tcgetattr(STDIN_FILENO, &oldt); // Get current terminal settings
-    newt = oldt;
-    newt.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
-    tcsetattr(STDIN_FILENO, TCSANOW, &newt); // Apply new settings
-    char ch = getchar(); // Capture a single keypress
-    tcsetattr(STDIN_FILENO, TCSANOW, &oldt); // Restore original settings
-    return ch;
+// The terminal is expected to be in raw mode already (see TerminalRawMode in pager.h), so
+// waiting for a key costs a single read instead of switching the terminal modes every time
+int getKeyStroke(int fd) {
+    unsigned char ch = 0;
+    ssize_t got;
+    while ((got = ::read(fd, &ch, 1)) < 0 && errno == EINTR) {
+    }
+    return got == 1 ? ch : -1;
 }
 
 #endif // HDIR_H
@@ -0,0 +1,366 @@
+// index.h 🐧
+//
+// Persistent directory index for ColorDir (--index FILE).
+// The index is a compact file of directory records keyed by (device, inode). Each record
+// holds the directory's mtime, the metadata of all its entries, the total size of its own
+// files and the key of its parent. Stale or missing records are rebuilt from the scan and
+// written back when the program ends.
+//
+// A directory's mtime only changes when entries are added, removed or renamed, not when a
+// file grows in place. So a listing only takes the names (and d_types) of an unchanged
+// directory from its record and looks up their metadata as usual, refreshing the record if it
+// changed. The -t (and --top) walk is what the index is for: it takes the file sizes of an unchanged
+// directory from the record, and counts a file that grew in place with its old size until
+// its directory changes (--help says so).
+//
+// A record is dropped when the directory is gone: when a -t walk covered its parent (went
+// into every subdirectory of it) without reaching it, or when its parent's record is dropped.
+//
+// File layout (native byte order): "CDIRIDX1", u32 version, u32 record count, then the
+// records back to back, each one an IndexRecordHeader followed by its entries.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "scan.h"
+
+// Identity and version of a directory
+struct DirKey {
+    std::uint64_t dev = 0;
+    std::uint64_t ino = 0;
+    std::int64_t mtimeSec = 0;
+    std::uint32_t mtimeNsec = 0;
+};
+
+// Look up the key of a directory with a single statx (symlinks are followed)
+bool directoryKey(const char* path, DirKey& key) {
+    struct statx info;
+    if (!statEntry(AT_FDCWD, path, STATX_INO | STATX_MTIME, info)) return false;
+    key.dev = (static_cast<std::uint64_t>(info.stx_dev_major) << 32) | info.stx_dev_minor;
+    key.ino = info.stx_ino;
+    key.mtimeSec = info.stx_mtime.tv_sec;
+    key.mtimeNsec = info.stx_mtime.tv_nsec;
+    return true;
+}
+
+// Look up the key of the directory above a directory (its "..", so it is the parent on disk)
+bool parentKey(const std::string& path, DirKey& key) {
+    return directoryKey((path + "/..").c_str(), key);
+}
+
+// On-disk header of one directory record
+struct IndexRecordHeader {
+    std::uint64_t dev;
+    std::uint64_t ino;
+    std::int64_t mtimeSec;
+    std::uint32_t mtimeNsec;
+    std::uint32_t entryCount;
+    std::uint64_t fileBytes;    // Total size of the regular files directly inside
+    std::uint64_t byteLength;   // Size of the whole record, header included
+    std::uint64_t parentDev;    // Key of the directory above (0, 0 if unknown)
+    std::uint64_t parentIno;
+};
+
+// On-disk header of one entry, followed by the name (padded to 8 bytes)
+struct IndexEntryHeader {
+    std::uint32_t mode;         // Mode after following symlinks, 0 if stat failed
+    std::uint8_t type;          // DT_* of the entry itself (DT_DIR only for real directories)
+    std::uint8_t reserved;
+    std::uint16_t nameLength;
+    std::uint64_t size;         // Size after following symlinks
+    std::int64_t mtime;         // Modification time after following symlinks
+};
+
+// A cached entry, as handed out by IndexRecord::forEach
+struct IndexedEntry {
+    const char* name;
+    size_t nameLength;
+    unsigned char type;
+    mode_t mode;
+    std::uint64_t size;
+    std::int64_t mtime;
+};
+
+// Read-only view of one record inside the mapped index
+class IndexRecord {
+public:
+    explicit IndexRecord(const IndexRecordHeader* header) : header(header) {}
+
+    std::uint64_t fileBytes() const { return header->fileBytes; }
+    std::uint32_t entryCount() const { return header->entryCount; }
+    std::string_view bytes() const { return {reinterpret_cast<const char*>(header), header->byteLength}; }
+
+    DirKey parent() const {
+        DirKey key;
+        key.dev = header->parentDev;
+        key.ino = header->parentIno;
+        return key;
+    }
+
+    // Call fn(const IndexedEntry&) for every cached entry
+    template <typename Fn>
+    void forEach(Fn fn) const {
+        const char* p = reinterpret_cast<const char*>(header + 1);
+        for (std::uint32_t i = 0; i < header->entryCount; ++i) {
+            const auto* entryHeader = reinterpret_cast<const IndexEntryHeader*>(p);
+            IndexedEntry entry;
+            entry.name = p + sizeof(IndexEntryHeader);
+            entry.nameLength = entryHeader->nameLength;
+            entry.type = entryHeader->type;
+            entry.mode = entryHeader->mode;
+            entry.size = entryHeader->size;
+            entry.mtime = entryHeader->mtime;
+            fn(entry);
+            p += entrySpan(entryHeader->nameLength);
+        }
+    }
+
+    static size_t entrySpan(size_t nameLength) {
+        return sizeof(IndexEntryHeader) + ((nameLength + 1 + 7) & ~size_t(7));
+    }
+
+private:
+    const IndexRecordHeader* header;
+};
+
+// Builds the serialized record of a directory while it is being scanned
+class IndexRecordBuilder {
+public:
+    void begin(const DirKey& key, const DirKey& parent) {
+        bytes.assign(sizeof(IndexRecordHeader), '\0');
+        header().dev = key.dev;
+        header().ino = key.ino;
+        header().mtimeSec = key.mtimeSec;
+        header().mtimeNsec = key.mtimeNsec;
+        header().parentDev = parent.dev;
+        header().parentIno = parent.ino;
+    }
+
+    void add(const char* name, size_t nameLength, unsigned char type, mode_t mode, std::uint64_t size, std::int64_t mtime) {
+        IndexEntryHeader entry = {};
+        entry.mode = mode;
+        entry.type = type;
+        entry.nameLength = static_cast<std::uint16_t>(nameLength);
+        entry.size = size;
+        entry.mtime = mtime;
+
+        size_t start = bytes.size();
+        bytes.resize(start + IndexRecord::entrySpan(nameLength), '\0');
+        std::memcpy(&bytes[start], &entry, sizeof(entry));
+        std::memcpy(&bytes[start + sizeof(entry)], name, nameLength);
+
+        header().entryCount++;
+        if (S_ISREG(mode)) header().fileBytes += size;
+    }
+
+    // Finish the record and hand over its bytes
+    std::string finish() {
+        header().byteLength = bytes.size();
+        return std::move(bytes);
+    }
+
+private:
+    IndexRecordHeader& header() { return *reinterpret_cast<IndexRecordHeader*>(&bytes[0]); }
+    std::string bytes;
+};
+
+class DirectoryIndex {
+public:
+    ~DirectoryIndex() { unmap(); }
+
+    // Map an existing index file; a missing or unreadable file simply starts an empty index
+    void open(const std::string& indexPath) {
+        path = indexPath;
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return;
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && info.st_size >= static_cast<off_t>(headerSize)) {
+            void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED) {
+                mapped = static_cast<const char*>(data);
+                mappedLength = info.st_size;
+                if (!loadRecords()) {
+                    records.clear(); // Corrupt or from another version: rebuild from scratch
+                    unmap();
+                }
+            }
+        }
+        ::close(fd);
+    }
+
+    // Return the cached record of a directory, if it is still up to date
+    // Every directory looked up counts as reached, so its record is kept (see save)
+    bool lookup(const DirKey& key, IndexRecord& record) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reached.insert(keyOf(key.dev, key.ino));
+        }
+        auto it = records.find(keyOf(key.dev, key.ino));
+        if (it == records.end()) return false;
+        const auto* header = reinterpret_cast<const IndexRecordHeader*>(mapped + it->second);
+        if (header->mtimeSec != key.mtimeSec || header->mtimeNsec != key.mtimeNsec) return false;
+        record = IndexRecord(header);
+        return true;
+    }
+
+    // Remember a freshly scanned directory (safe to call from several threads)
+    void store(const DirKey& key, std::string record) {
+        std::lock_guard<std::mutex> lock(mutex);
+        updated[keyOf(key.dev, key.ino)] = std::move(record);
+    }
+
+    // Note that every subdirectory of a directory was looked up (a -t walk went into all of
+    // them), so the old records below it that were not reached belong to removed directories
+    void cover(const DirKey& key) {
+        std::lock_guard<std::mutex> lock(mutex);
+        covered.push_back(keyOf(key.dev, key.ino));
+    }
+
+    // Write the new records plus the still-unchanged old ones, replacing the file atomically
+    // The old records of removed directories are left out
+    bool save() {
+        std::unordered_set<Key, KeyHash> removed = removedRecords();
+        if (path.empty() || (updated.empty() && removed.empty())) return true;
+
+        std::string temporary = path + ".tmp";
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+
+        std::uint32_t count = static_cast<std::uint32_t>(updated.size());
+        for (const auto& [key, offset] : records) {
+            if (!updated.count(key) && !removed.count(key)) count++;
+        }
+
+        std::string chunk(magic, 8);
+        std::uint32_t version = formatVersion;
+        chunk.append(reinterpret_cast<const char*>(&version), sizeof(version));
+        chunk.append(reinterpret_cast<const char*>(&count), sizeof(count));
+
+        bool ok = true;
+        auto flushChunk = [&](bool force) {
+            if (!ok || (!force && chunk.size() < (1 << 20))) return;
+            ok = ::write(fd, chunk.data(), chunk.size()) == static_cast<ssize_t>(chunk.size());
+            chunk.clear();
+        };
+
+        for (const auto& [key, offset] : records) {
+            if (updated.count(key) || removed.count(key)) continue;
+            const auto* header = reinterpret_cast<const IndexRecordHeader*>(mapped + offset);
+            chunk.append(mapped + offset, header->byteLength);
+            flushChunk(false);
+        }
+        for (const auto& [key, record] : updated) {
+            chunk.append(record);
+            flushChunk(false);
+        }
+        flushChunk(true);
+
+        ok = (::close(fd) == 0) && ok;
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+            unlink(temporary.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool enabled() const { return !path.empty(); }
+
+private:
+    struct KeyHash {
+        size_t operator()(const std::pair<std::uint64_t, std::uint64_t>& key) const {
+            return std::hash<std::uint64_t>()(key.first * 0x9e3779b97f4a7c15ull ^ key.second);
+        }
+    };
+    using Key = std::pair<std::uint64_t, std::uint64_t>;
+
+    static Key keyOf(std::uint64_t dev, std::uint64_t ino) { return {dev, ino}; }
+
+    // Old records not reached by this run whose parent was covered, or is one of them itself
+    std::unordered_set<Key, KeyHash> removedRecords() const {
+        std::unordered_set<Key, KeyHash> removed;
+        if (covered.empty()) return removed;
+        std::unordered_map<Key, std::vector<Key>, KeyHash> unreached; // By parent
+        for (const auto& [key, offset] : records) {
+            if (reached.count(key)) continue;
+            const auto* header = reinterpret_cast<const IndexRecordHeader*>(mapped + offset);
+            unreached[keyOf(header->parentDev, header->parentIno)].push_back(key);
+        }
+        std::vector<Key> pending = covered;
+        while (!pending.empty()) {
+            auto below = unreached.find(pending.back());
+            pending.pop_back();
+            if (below == unreached.end()) continue;
+            for (const Key& key : below->second) {
+                if (removed.insert(key).second) pending.push_back(key);
+            }
+        }
+        return removed;
+    }
+
+    // Validate the mapped file and index its records by (dev, ino)
+    bool loadRecords() {
+        if (std::memcmp(mapped, magic, 8) != 0) return false;
+        std::uint32_t version, count;
+        std::memcpy(&version, mapped + 8, sizeof(version));
+        std::memcpy(&count, mapped + 12, sizeof(count));
+        if (version != formatVersion) return false;
+
+        size_t offset = headerSize;
+        for (std::uint32_t i = 0; i < count; ++i) {
+            if (offset + sizeof(IndexRecordHeader) > mappedLength) return false;
+            const auto* header = reinterpret_cast<const IndexRecordHeader*>(mapped + offset);
+            if (header->byteLength < sizeof(IndexRecordHeader) || header->byteLength > mappedLength - offset) return false;
+
+            // Check that all entries fit inside the record
+            size_t position = sizeof(IndexRecordHeader);
+            for (std::uint32_t e = 0; e < header->entryCount; ++e) {
+                if (position + sizeof(IndexEntryHeader) > header->byteLength) return false;
+                const auto* entry = reinterpret_cast<const IndexEntryHeader*>(mapped + offset + position);
+                position += IndexRecord::entrySpan(entry->nameLength);
+                if (position > header->byteLength) return false;
+            }
+
+            records[keyOf(header->dev, header->ino)] = offset;
+            offset += header->byteLength;
+        }
+        return true;
+    }
+
+    void unmap() {
+        if (mapped) munmap(const_cast<char*>(mapped), mappedLength);
+        mapped = nullptr;
+        mappedLength = 0;
+    }
+
+    static constexpr const char* magic = "CDIRIDX1";
+    static constexpr std::uint32_t formatVersion = 2;
+    static constexpr size_t headerSize = 16;
+
+    std::string path;                                     // Index file, empty when disabled
+    const char* mapped = nullptr;                         // Mapped contents of the old index
+    size_t mappedLength = 0;
+    std::unordered_map<Key, size_t, KeyHash> records;     // Old records: (dev, ino) -> offset
+    std::mutex mutex;                                     // Guards updated, reached and covered
+    std::unordered_map<Key, std::string, KeyHash> updated; // Records rebuilt during this run
+    std::unordered_set<Key, KeyHash> reached;             // Directories looked up during this run
+    std::vector<Key> covered;                             // Directories whose subdirectories all were
+};
+
+#endif // INDEX_H
@@ -0,0 +1,210 @@
+// inodes.h 🐧
+//
+// Hard-link bookkeeping for ColorDir (--disk-usage).
+// A file with several links is charged once. Files with a single link never get here, so the
+// tables below only grow with the hard links of the tree. They are built for trees made mostly
+// of them (e.g. backup snapshots): every inode takes one 8-byte key in an open-addressing table,
+// its device folded into the top byte as a small number, next to whatever is kept for it, and
+// the table is split into shards with a lock each, so the threads of a parallel traversal
+// rarely wait for each other.
+//
+//   InodeSet     the files charged so far in the whole run
+//   LinkOwners   during one parallel walk (-t, --top): the link each file is charged to, the
+//                one with the smallest key, so which link that is doesn't depend on which
+//                thread happened to see a link first
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef INODES_H
+#define INODES_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include <sys/types.h>
+
+// Inodes of several devices, each with a Value
+template <typename Value>
+class InodeTable {
+public:
+    // Call update(value, added) for a file, under the lock of its shard; added is true if the
+    // file was not in the table before (value is then default-constructed)
+    template <typename Update>
+    void update(std::uint64_t device, std::uint64_t inode, Update update) {
+        std::uint64_t id = deviceId(device);
+        if (id == 0 || inode >> inodeBits != 0) {
+            // Too many devices, or an inode number that doesn't leave room for one: kept apart
+            std::lock_guard<std::mutex> lock(overflowMutex);
+            auto placed = overflow.try_emplace({device, inode});
+            update(placed.first->second, placed.second);
+            return;
+        }
+        std::uint64_t key = id << inodeBits | inode;
+        std::uint64_t hash = mix(key);
+        Shard& shard = shards[hash >> (64 - shardBits)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if ((shard.used + 1) * 10 > shard.keys.size() * 7) grow(shard);
+        bool added = false;
+        size_t slot = place(shard, key, hash, added);
+        update(shard.values[slot], added);
+    }
+
+    // Call visit(device, inode, value) for every file, in no particular order
+    // Only while no other thread uses the table
+    template <typename Visit>
+    void forEach(Visit visit) {
+        for (Shard& shard : shards) {
+            for (size_t i = 0; i < shard.keys.size(); ++i) {
+                if (shard.keys[i] == 0) continue;
+                visit(devices[(shard.keys[i] >> inodeBits) - 1], shard.keys[i] & inodeMask, shard.values[i]);
+            }
+        }
+        for (auto& [file, value] : overflow) visit(file.first, file.second, value);
+    }
+
+    // Forget every file (the memory is given back); only while no other thread uses the table
+    void clear() {
+        for (Shard& shard : shards) {
+            shard.keys = std::vector<std::uint64_t>();
+            shard.values = std::vector<Value>();
+            shard.used = 0;
+        }
+        overflow.clear();
+    }
+
+private:
+    static constexpr unsigned inodeBits = 56;  // The top byte holds the device number
+    static constexpr std::uint64_t inodeMask = (std::uint64_t(1) << inodeBits) - 1;
+    static constexpr unsigned shardBits = 6;
+    static constexpr size_t shardCount = size_t(1) << shardBits;
+    static constexpr size_t initialSlots = 1024; // Per shard, allocated on first use
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::vector<std::uint64_t> keys; // 0: empty (device numbers start at 1)
+        std::vector<Value> values;       // Same slots as keys
+        size_t used = 0;
+    };
+
+    // Finalizer of splitmix64: spreads consecutive inode numbers over shards and slots
+    static std::uint64_t mix(std::uint64_t value) {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ull;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebull;
+        return value ^ (value >> 31);
+    }
+
+    // Linear probing; the low bits of the hash pick the first slot. Returns the slot of the key.
+    static size_t place(Shard& shard, std::uint64_t key, std::uint64_t hash, bool& added) {
+        size_t mask = shard.keys.size() - 1;
+        for (size_t i = static_cast<size_t>(hash) & mask;; i = (i + 1) & mask) {
+            if (shard.keys[i] == key) return i;
+            if (shard.keys[i] == 0) {
+                shard.keys[i] = key;
+                shard.used++;
+                added = true;
+                return i;
+            }
+        }
+    }
+
+    // Double the table of a shard (or allocate it) and insert everything again
+    static void grow(Shard& shard) {
+        std::vector<std::uint64_t> oldKeys = std::move(shard.keys);
+        std::vector<Value> oldValues = std::move(shard.values);
+        size_t size = oldKeys.empty() ? initialSlots : oldKeys.size() * 2;
+        shard.keys.assign(size, 0);
+        shard.values.assign(size, Value());
+        shard.used = 0;
+        for (size_t i = 0; i < oldKeys.size(); ++i) {
+            if (oldKeys[i] == 0) continue;
+            bool added = false;
+            shard.values[place(shard, oldKeys[i], mix(oldKeys[i]), added)] = std::move(oldValues[i]);
+        }
+    }
+
+    // Small number for a device, 1 to 255; 0 once there are more devices than that
+    // A tree rarely spans more than a few, and each thread remembers the last one it asked for
+    std::uint64_t deviceId(std::uint64_t device) {
+        static thread_local std::uint64_t lastTable = 0; // Serial numbers: an address may be reused
+        static thread_local std::uint64_t lastDevice = 0;
+        static thread_local std::uint64_t lastId = 0;
+        if (lastTable == serial && lastDevice == device) return lastId;
+        std::lock_guard<std::mutex> lock(devicesMutex);
+        size_t i = 0;
+        while (i < devices.size() && devices[i] != device) ++i;
+        if (i == devices.size()) {
+            if (devices.size() == 255) return 0;
+            devices.push_back(device);
+        }
+        lastTable = serial;
+        lastDevice = device;
+        lastId = i + 1;
+        return lastId;
+    }
+
+    static inline std::atomic<std::uint64_t> tables{0};
+    const std::uint64_t serial = ++tables; // Tells the tables apart in the cache of deviceId
+    Shard shards[shardCount];
+    std::mutex devicesMutex;
+    std::vector<std::uint64_t> devices;  // Index + 1 is the number of a device (never forgotten)
+    std::mutex overflowMutex;
+    std::map<std::pair<std::uint64_t, std::uint64_t>, Value> overflow;
+};
+
+class InodeSet {
+public:
+    // The set of the whole run, shared by all threads
+    static InodeSet& instance() {
+        static InodeSet set;
+        return set;
+    }
+
+    // Add a file, returns false if it was added before
+    bool insert(std::uint64_t device, std::uint64_t inode) {
+        bool added = false;
+        table.update(device, inode, [&added](Empty&, bool isNew) { added = isNew; });
+        return added;
+    }
+
+    // Forget every file, so a tree can be measured again (--check)
+    void clear() { table.clear(); }
+
+private:
+    struct Empty {};
+    InodeTable<Empty> table;
+};
+
+// The link a file is charged to, out of those one walk has seen
+struct LinkOwner {
+    std::uint64_t rank = 0;      // Key of the link (see SizeAggregator::linkRank), the smallest wins
+    std::uintmax_t size = 0;     // Bytes the file adds to the totals
+    std::uint32_t directory = 0; // Where the link is, numbered by the walk
+    mode_t mode = 0;
+};
+
+// Keeps the link with the smallest rank of every file
+class LinkOwners {
+public:
+    void offer(std::uint64_t device, std::uint64_t inode, const LinkOwner& link) {
+        table.update(device, inode, [&link](LinkOwner& owner, bool added) {
+            if (added || link.rank < owner.rank) owner = link;
+        });
+    }
+
+    template <typename Visit>
+    void forEach(Visit visit) { table.forEach(visit); }
+
+    void clear() { table.clear(); }
+
+private:
+    InodeTable<LinkOwner> table;
+};
+
+#endif // INODES_H
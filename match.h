@@ -0,0 +1,164 @@
+// match.h 🐧
+//
+// Pattern filter for ColorDir.
+// The wildcard pattern is compiled once into a matcher. Common shapes get a fast path that
+// uses glibc's vectorized string routines (memcmp, memmem, strspn/strcspn); anything else
+// falls back to fnmatch, with the same flags the listing always used (FNM_PATHNAME).
+//
+//   "*"          match everything
+//   "abc*"       prefix          "*.log"     suffix
+//   "*abc*"      contains        "*[!0-9]*"  contains a character from a set (or outside it)
+//
+// Several patterns can be given; a name matches if it matches any of them.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef MATCH_H
+#define MATCH_H
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fnmatch.h>
+
+class PatternMatcher {
+public:
+    PatternMatcher() = default;
+    explicit PatternMatcher(const std::string& pattern) { compile(pattern); }
+
+    // Analyze the pattern and pick the cheapest way to evaluate it
+    void compile(const std::string& pattern) {
+        source = pattern;
+        literal.clear();
+        charSet.clear();
+        alternatives.clear();
+        kind = Kind::General;
+
+        if (pattern.empty() || pattern.find_first_not_of('*') == std::string::npos) {
+            kind = Kind::All;
+            return;
+        }
+
+        // "*[set]*": a name matches if it holds any character of the set (or not of it)
+        if (pattern.size() > 4 && pattern.front() == '*' && pattern.back() == '*' && pattern[1] == '[' &&
+            parseCharClass(pattern.substr(1, pattern.size() - 2))) {
+            return;
+        }
+
+        // Literal text around leading/trailing stars; '?', '[' and '\' need the general matcher
+        size_t first = pattern.find_first_not_of('*');
+        size_t last = pattern.find_last_not_of('*');
+        std::string core = pattern.substr(first, last - first + 1);
+        if (core.find_first_of("*?[\\") != std::string::npos) return;
+
+        bool leadingStar = first > 0;
+        bool trailingStar = last + 1 < pattern.size();
+        literal = core;
+        if (leadingStar && trailingStar) kind = Kind::Contains;
+        else if (leadingStar) kind = Kind::Suffix;
+        else if (trailingStar) kind = Kind::Prefix;
+        else kind = Kind::Exact;
+    }
+
+    // Compile several patterns, each with its own fast path; "*" among them matches everything
+    void compile(const std::vector<std::string>& patterns) {
+        if (patterns.size() == 1) {
+            compile(patterns.front());
+            return;
+        }
+        compile(std::string()); // Everything, unless there are patterns
+        std::vector<PatternMatcher> compiled;
+        for (const auto& pattern : patterns) {
+            compiled.emplace_back(pattern);
+            if (compiled.back().matchesEverything()) return;
+        }
+        if (compiled.empty()) return;
+        for (size_t i = 0; i < patterns.size(); ++i) source += (i ? " " : "") + patterns[i];
+        alternatives = std::move(compiled);
+        kind = Kind::AnyOf;
+    }
+
+    // True if a file name (not a path) matches the pattern
+    bool matches(const char* name, size_t length) const {
+        switch (kind) {
+            case Kind::All: return true;
+            case Kind::Exact:
+                return length == literal.size() && std::memcmp(name, literal.data(), length) == 0;
+            case Kind::Prefix:
+                return length >= literal.size() && std::memcmp(name, literal.data(), literal.size()) == 0;
+            case Kind::Suffix:
+                return length >= literal.size() &&
+                       std::memcmp(name + length - literal.size(), literal.data(), literal.size()) == 0;
+            case Kind::Contains:
+                return memmem(name, length, literal.data(), literal.size()) != nullptr;
+            case Kind::AnyInSet:
+                return std::strcspn(name, charSet.c_str()) < length;
+            case Kind::AnyOutsideSet:
+                return std::strspn(name, charSet.c_str()) < length;
+            case Kind::AnyOf:
+                for (const auto& alternative : alternatives) {
+                    if (alternative.matches(name, length)) return true;
+                }
+                return false;
+            default:
+                return fnmatch(source.c_str(), name, FNM_PATHNAME) == 0;
+        }
+    }
+
+    bool matches(const std::string& name) const { return matches(name.c_str(), name.size()); }
+
+    // True when every name matches, so callers can skip the filter entirely
+    bool matchesEverything() const { return kind == Kind::All; }
+
+    const std::string& pattern() const { return source; }
+
+private:
+    enum class Kind { All, Exact, Prefix, Suffix, Contains, AnyInSet, AnyOutsideSet, AnyOf, General };
+
+    // Parse a bracket expression such as "[x]", "[a-z_]" or "[!0-9]" into an explicit set
+    // Named classes ("[:alpha:]"), escapes and anything unusual are left to fnmatch
+    bool parseCharClass(const std::string& bracket) {
+        if (bracket.size() < 3 || bracket.front() != '[' || bracket.back() != ']') return false;
+        size_t i = 1;
+        bool negated = false;
+        if (bracket[i] == '!' || bracket[i] == '^') {
+            negated = true;
+            ++i;
+        }
+        size_t end = bracket.size() - 1;
+        if (i >= end) return false;
+
+        bool members[256] = {};
+        for (size_t j = i; j < end; ++j) {
+            unsigned char c = static_cast<unsigned char>(bracket[j]);
+            if (c == '\\' || c == '[' || (c == ']' && j != i)) return false;
+            if (j + 2 < end && bracket[j + 1] == '-') {
+                unsigned char upper = static_cast<unsigned char>(bracket[j + 2]);
+                if (upper < c || upper == '\\' || upper == '[' || upper == ']') return false;
+                for (unsigned v = c; v <= upper; ++v) members[v] = true;
+                j += 2;
+            } else {
+                members[c] = true;
+            }
+        }
+
+        members[0] = false; // Names never contain NUL, and the set is NUL-terminated
+        members[static_cast<unsigned char>('/')] = false; // FNM_PATHNAME: brackets never match '/'
+        for (unsigned v = 1; v < 256; ++v) {
+            if (members[v]) charSet += static_cast<char>(v);
+        }
+        if (!negated && charSet.empty()) return false;
+        kind = negated ? Kind::AnyOutsideSet : Kind::AnyInSet;
+        return true;
+    }
+
+    std::string source;            // Original pattern, used by the fnmatch fallback (all of them, for AnyOf)
+    std::string literal;           // Literal part for the prefix/suffix/contains fast paths
+    std::string charSet;           // Expanded bracket set for the character class fast paths
+    std::vector<PatternMatcher> alternatives; // AnyOf: one matcher per pattern
+    Kind kind = Kind::All;
+};
+
+#endif // MATCH_H
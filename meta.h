@@ -0,0 +1,385 @@
+// meta.h 🐧
+//
+// Batched metadata lookups for ColorDir.
+// A directory is read in two steps: first all names, then the statx calls for the entries
+// that need one, handed over as a batch. The batch goes through io_uring with up to
+// --queue-depth lookups in flight, so on network filesystems the round trips overlap
+// instead of adding up. Without io_uring (old kernels, or blocked by a seccomp filter) the
+// batch is split over a few helper threads instead. A queue depth of 1 makes every lookup a
+// plain blocking statx on the calling thread, as before, which is also what local
+// filesystems get unless --queue-depth asks for more.
+// The ring is set up with raw system calls (no liburing), one per thread that needs it.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef META_H
+#define META_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/vfs.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+#include "perf.h"
+#include "pool.h"
+#include "scan.h"
+
+// One statx lookup of a batch
+struct StatRequest {
+    const char* name = nullptr; // NUL-terminated, relative to the directory of the batch
+    unsigned int mask = 0;      // statx fields wanted
+    bool follow = true;         // Follow a symlink to its target
+    bool ok = false;            // Result: the lookup succeeded
+    struct statx info;          // Result: the metadata
+};
+
+// Lookups in flight per thread (--queue-depth)
+inline std::atomic<unsigned> metadataQueueDepth{64};
+
+// Without --queue-depth, only directories on network filesystems are fetched asynchronously:
+// on a local filesystem a cached statx takes less time than handing it to an io_uring worker
+inline std::atomic<bool> metadataQueueAuto{true};
+
+// True for filesystems where every lookup may be a round trip to a server
+inline bool isRemoteFilesystem(int dirFd) {
+    struct statfs info;
+    if (fstatfs(dirFd, &info) != 0) return false;
+    switch (static_cast<unsigned long>(info.f_type)) {
+        case 0x6969:      // NFS
+        case 0xFF534D42:  // CIFS
+        case 0xFE534D42:  // SMB2
+        case 0x517B:      // SMB
+        case 0x00C36400:  // Ceph
+        case 0x65735546:  // FUSE (sshfs, cloud drives, ...)
+        case 0x5346414F:  // AFS
+        case 0x6B414653:  // kAFS
+        case 0x01021997:  // 9p
+        case 0x47504653:  // GPFS
+        case 0x0BD00BD0:  // Lustre
+            return true;
+        default:
+            return false;
+    }
+}
+
+// True when a batch of count lookups in dirFd is best run one after the other on the calling
+// thread: a queue depth of 1, a single lookup, or a local filesystem without --queue-depth
+inline bool runsSerially(int dirFd, size_t count, unsigned depth) {
+    return depth <= 1 || count == 1 || (metadataQueueAuto.load(std::memory_order_relaxed) && !isRemoteFilesystem(dirFd));
+}
+
+// Cleared once io_uring turns out to be unavailable, so no thread tries to set it up again
+inline std::atomic<bool> uringAvailable{true};
+
+// A small io_uring that only runs statx
+class UringStatQueue {
+public:
+    UringStatQueue() = default;
+    ~UringStatQueue() { close(); }
+
+    UringStatQueue(const UringStatQueue&) = delete;
+    UringStatQueue& operator=(const UringStatQueue&) = delete;
+
+    // Set up a ring for depth lookups, returns false if io_uring or its statx is unavailable
+    // (error() tells why it failed)
+    bool open(unsigned depth) {
+        struct io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+        if (ringFd < 0) {
+            lastError = errno;
+            return false;
+        }
+        if (!supportsStatx()) lastError = EINVAL;
+        else if (!mapRings(params)) lastError = errno;
+        if (lastError != 0) {
+            close();
+            return false;
+        }
+        entries = params.sq_entries;
+        return true;
+    }
+
+    // Run count lookups relative to dirFd, keeping up to the ring size in flight
+    // Returns false if the ring failed; requests that did not complete have ok == false
+    bool run(int dirFd, StatRequest* requests, size_t count) {
+        size_t submitted = 0;   // Requests placed in the submission queue
+        size_t completed = 0;
+        unsigned queued = 0;    // Placed in the queue, not yet consumed by the kernel
+        unsigned inFlight = 0;  // Consumed by the kernel, not yet completed
+        while (completed < count) {
+            // Fill the submission queue
+            unsigned tail = sqTail->load(std::memory_order_relaxed);
+            unsigned added = 0;
+            while (submitted < count && inFlight + queued < entries) {
+                StatRequest& request = requests[submitted];
+                unsigned index = tail & sqMask;
+                struct io_uring_sqe& sqe = sqes[index];
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_STATX;
+                sqe.fd = dirFd;
+                sqe.addr = reinterpret_cast<std::uintptr_t>(request.name);
+                sqe.len = request.mask;
+                sqe.off = reinterpret_cast<std::uintptr_t>(&request.info);
+                sqe.statx_flags = AT_NO_AUTOMOUNT | (request.follow ? 0 : AT_SYMLINK_NOFOLLOW);
+                sqe.user_data = submitted;
+                sqArray[index] = index;
+                request.ok = false;
+                ++tail;
+                ++queued;
+                ++added;
+                ++submitted;
+            }
+            sqTail->store(tail, std::memory_order_release);
+            countEvent(PerfEvent::Statx, added);
+
+            // Submit them and wait for at least one completion
+            countEvent(PerfEvent::UringEnter);
+            long result = syscall(__NR_io_uring_enter, ringFd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (result < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) return false;
+            if (result > 0) {
+                // Entries the kernel did not take yet stay queued for the next round
+                inFlight += static_cast<unsigned>(result);
+                queued -= static_cast<unsigned>(result);
+            }
+
+            // Reap the completions
+            unsigned head = cqHead->load(std::memory_order_relaxed);
+            unsigned ready = cqTail->load(std::memory_order_acquire);
+            for (; head != ready; ++head, ++completed, --inFlight) {
+                const struct io_uring_cqe& cqe = cqes[head & cqMask];
+                requests[cqe.user_data].ok = (cqe.res == 0);
+            }
+            cqHead->store(head, std::memory_order_release);
+        }
+        return true;
+    }
+
+    // errno of the failed open()
+    int error() const { return lastError; }
+
+private:
+    // Ask the kernel whether it knows IORING_OP_STATX (added in Linux 5.6)
+    bool supportsStatx() {
+        constexpr unsigned opCount = 256;
+        std::unique_ptr<char[]> storage(new char[sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op)]());
+        auto* probe = reinterpret_cast<io_uring_probe*>(storage.get());
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, opCount) < 0) return false;
+        return probe->last_op >= IORING_OP_STATX && (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED);
+    }
+
+    bool mapRings(const struct io_uring_params& params) {
+        sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+
+        sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) return false;
+        cqMap = single ? sqMap
+                       : mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+        if (cqMap == MAP_FAILED) return false;
+        sqeMapSize = params.sq_entries * sizeof(struct io_uring_sqe);
+        void* sqeMap = mmap(nullptr, sqeMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED) return false;
+        sqes = static_cast<struct io_uring_sqe*>(sqeMap);
+
+        char* sq = static_cast<char*>(sqMap);
+        char* cq = static_cast<char*>(cqMap);
+        sqTail = reinterpret_cast<std::atomic<unsigned>*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        cqHead = reinterpret_cast<std::atomic<unsigned>*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<std::atomic<unsigned>*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<struct io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    void close() {
+        if (sqes) munmap(sqes, sqeMapSize);
+        if (cqMap && cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqMapSize);
+        if (sqMap && sqMap != MAP_FAILED) munmap(sqMap, sqMapSize);
+        if (ringFd >= 0) ::close(ringFd);
+        sqes = nullptr;
+        sqMap = cqMap = nullptr;
+        ringFd = -1;
+    }
+
+    int ringFd = -1;
+    int lastError = 0;
+    unsigned entries = 0;                         // Submission queue size
+    void* sqMap = nullptr;                        // Submission ring mapping
+    void* cqMap = nullptr;                        // Completion ring mapping (may be the same)
+    size_t sqMapSize = 0;
+    size_t cqMapSize = 0;
+    size_t sqeMapSize = 0;
+    struct io_uring_sqe* sqes = nullptr;          // Submission queue entries
+    std::atomic<unsigned>* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    std::atomic<unsigned>* cqHead = nullptr;
+    std::atomic<unsigned>* cqTail = nullptr;
+    unsigned cqMask = 0;
+    struct io_uring_cqe* cqes = nullptr;
+};
+
+// Run requests[0..count) one blocking statx after the other
+inline void runStatRequests(int dirFd, StatRequest* requests, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        StatRequest& request = requests[i];
+        request.ok = statEntry(dirFd, request.name, request.mask, request.info, request.follow);
+    }
+}
+
+// Helper threads that split a batch between them when there is no io_uring
+// A batch is cut into slices; the calling thread works on slices too, then waits for the rest
+// There are as many helpers as lookups may be in flight, up to 16; they are started on first use
+class StatHelpers {
+public:
+    static StatHelpers& instance(unsigned depth) {
+        static StatHelpers helpers(std::min(depth, 16u));
+        return helpers;
+    }
+
+    void run(int dirFd, StatRequest* requests, size_t count) {
+        forEachSlice(count, [dirFd, requests](size_t first, size_t length) {
+            runStatRequests(dirFd, requests + first, length);
+        });
+    }
+
+    // Call body(first, length) for slices that cover [0, count), returns once all are done
+    // (also used for the header reads of --sniff, see sniff.h)
+    template <typename Body>
+    void forEachSlice(size_t count, Body body) {
+        const size_t slices = pool.size() + 1;
+        const size_t sliceSize = std::max<size_t>(8, (count + slices - 1) / slices);
+        struct Batch {
+            std::mutex mutex;
+            std::condition_variable done;
+            size_t remaining = 0;    // Slices still running on helpers
+        } batch;
+
+        size_t first = sliceSize; // The first slice stays on this thread
+        for (; first < count; first += sliceSize) {
+            size_t length = std::min(sliceSize, count - first);
+            {
+                std::lock_guard<std::mutex> lock(batch.mutex);
+                batch.remaining++;
+            }
+            pool.submit([&batch, &body, first, length] {
+                body(first, length);
+                std::lock_guard<std::mutex> lock(batch.mutex);
+                if (--batch.remaining == 0) batch.done.notify_one();
+            });
+        }
+        body(size_t(0), std::min(sliceSize, count));
+
+        std::unique_lock<std::mutex> lock(batch.mutex);
+        batch.done.wait(lock, [&] { return batch.remaining == 0; });
+    }
+
+private:
+    explicit StatHelpers(unsigned threads) : pool(threads) {}
+
+    WorkStealingPool pool;
+};
+
+// Fetch the metadata of a batch of entries of one directory, as configured by --queue-depth
+inline void fetchMetadata(int dirFd, StatRequest* requests, size_t count) {
+    if (count == 0) return;
+    PhaseScope phase(Phase::Stat);
+    unsigned depth = metadataQueueDepth.load(std::memory_order_relaxed);
+    if (runsSerially(dirFd, count, depth)) {
+        runStatRequests(dirFd, requests, count);
+        return;
+    }
+
+    // One ring per thread, set up on first use
+    static thread_local std::unique_ptr<UringStatQueue> ring;
+    static thread_local bool ringFailed = false;
+    if (!ring && !ringFailed && uringAvailable.load(std::memory_order_relaxed)) {
+        ring = std::make_unique<UringStatQueue>();
+        if (!ring->open(depth)) {
+            ringFailed = true;
+            // A missing io_uring is missing for every thread; a full file table only for this one
+            int error = ring->error();
+            if (error == ENOSYS || error == EPERM || error == EINVAL) {
+                uringAvailable.store(false, std::memory_order_relaxed);
+            }
+            ring.reset();
+        }
+    }
+    if (ring) {
+        if (ring->run(dirFd, requests, count)) return;
+        ring.reset(); // Broken ring: finish this batch and all later ones without it
+        ringFailed = true;
+        for (size_t i = 0; i < count; ++i) {
+            if (!requests[i].ok) requests[i].ok = statEntry(dirFd, requests[i].name, requests[i].mask,
+                                                            requests[i].info, requests[i].follow);
+        }
+        return;
+    }
+    if (count < 16) {
+        runStatRequests(dirFd, requests, count); // Not worth waking the helpers
+        return;
+    }
+    StatHelpers::instance(depth).run(dirFd, requests, count);
+}
+
+// Collects the lookups of one directory and runs them a batch at a time
+// Names are copied, so they may come straight from the scanner buffer; every lookup carries a
+// tag (e.g. the index of its entry) for matching the results up afterwards
+class StatBatch {
+public:
+    static constexpr size_t capacity = 256; // Lookups collected before the batch has to run
+
+    StatBatch() : requests(capacity), nameOffsets(capacity), tags(capacity) {}
+
+    void add(const char* name, size_t length, unsigned int mask, bool follow, std::uint32_t tag = 0) {
+        StatRequest& request = requests[count];
+        request.mask = mask;
+        request.follow = follow;
+        nameOffsets[count] = names.size();
+        names.insert(names.end(), name, name + length + 1); // With the NUL
+        tags[count] = tag;
+        count++;
+    }
+
+    bool full() const { return count == capacity; }
+    size_t size() const { return count; }
+
+    // Run every collected lookup relative to dirFd
+    void run(int dirFd) {
+        for (size_t i = 0; i < count; ++i) requests[i].name = names.data() + nameOffsets[i];
+        fetchMetadata(dirFd, requests.data(), count);
+    }
+
+    const StatRequest& operator[](size_t i) const { return requests[i]; }
+    const char* name(size_t i) const { return names.data() + nameOffsets[i]; }
+    std::uint32_t tag(size_t i) const { return tags[i]; }
+
+    // Forget the lookups, keeping the memory for the next batch
+    void clear() {
+        count = 0;
+        names.clear();
+    }
+
+private:
+    std::vector<StatRequest> requests;
+    std::vector<size_t> nameOffsets; // Names move while the buffer grows, so keep offsets
+    std::vector<std::uint32_t> tags;
+    std::vector<char> names;
+    size_t count = 0;
+};
+
+#endif // META_H
@@ -0,0 +1,663 @@
+// micro.h 🐧
+//
+// Micro-benchmarks and self-checks for ColorDir (--bench-micro, --check).
+// --bench-micro times the small functions every listed entry goes through, one at a time, on a
+// fixed set of synthetic entries, and reports ns/op and heap allocations/op for each of them.
+// --check runs assertions and exits with status 1 if one of them fails:
+//
+//   render  the list view, the multi-column view and the records must not allocate once
+//           their buffers have grown (no more temporary strings per entry)
+//   input   names, file headers and sizes come from the file system, so the code that parses
+//           them is fed random bytes and compared with a reference, or checked for the
+//           invariants it promises (run it from an -fsanitize=address build to catch overruns)
+//   links   --disk-usage on a tree of hard links must print the same totals and --top on one
+//           thread as on several
+//
+// Everything is seeded, so a failure reproduces on every run.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef MICRO_H
+#define MICRO_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fnmatch.h>
+#include <sys/wait.h>
+#include "hdir.h"
+#include "arena.h"
+#include "sort.h"
+#include "perf.h"
+#include "match.h"
+#include "width.h"
+#include "sniff.h"
+#include "record.h"
+#include "render.h"
+#include "bench.h"
+
+// Implemented in c.cpp
+bool classifyExtension(const char* name, size_t length, FileType& type);
+std::string toLower(const std::string& str);
+void displayMultiColumn(EntryRange entries);
+
+// Keeps the compiler from dropping the results of the measured calls
+inline volatile std::uint64_t microSink = 0;
+
+// Synthetic entries: the file names of the benchmark trees, some directories, hidden files,
+// names with multi-byte characters and emoji, invalid UTF-8, and entries without metadata
+class MicroEntries {
+public:
+    explicit MicroEntries(size_t count) : names(1 << 16) {
+        static const char* const special[] = {
+            "r\xc3\xa9sum\xc3\xa9_final_version.docx", "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae"
+            "\xe3\x83\x95\xe3\x82\xa1\xe3\x82\xa4\xe3\x83\xab.md", "\xf0\x9f\x90\xa7 penguin.png",
+            "\xf0\x9f\x91\xa9\xe2\x80\x8d\xf0\x9f\x92\xbb notes.txt", "broken\xff\xfe name.bin",
+            "A Rather Long File Name That Will Not Fit Any Column.tar.gz", "Makefile", ".bashrc",
+        };
+        BenchTreeGenerator generator(20250502);
+        BenchRandom random(20250503);
+        for (size_t i = 0; i < count; ++i) {
+            std::string name = (i % 16 == 7) ? special[(i / 16) % (sizeof(special) / sizeof(special[0]))]
+                                             : generator.fileName(i);
+            DirEntry entry;
+            entry.name = names.store(name.data(), name.size());
+            entry.isHidden = name[0] == '.';
+            entry.isDirectory = random.below(10) == 0;
+            entry.isRegularFile = !entry.isDirectory;
+            entry.hasStat = random.below(50) != 0;
+            if (entry.hasStat) {
+                entry.mode = (entry.isDirectory ? S_IFDIR | 0755 : S_IFREG | (random.below(20) ? 0644 : 0755));
+                entry.size = random.below(std::uint64_t(1) << random.below(40));
+                entry.mtime = static_cast<time_t>(1500000000 + random.below(300000000));
+            }
+            entries.push_back(entry);
+        }
+        for (auto& entry : entries) {
+            if (!entry.isDirectory) entry.type = categorizeFile(entry);
+        }
+    }
+
+    std::vector<DirEntry> entries;
+
+private:
+    NameArena names;
+};
+
+// Time operations calls of op(i) and print ns/op and allocations/op
+// op returns a value that depends on its result, so the call can't be optimized away
+template <typename Op>
+void benchOperation(const char* name, size_t operations, Op op) {
+    std::uint64_t sink = 0;
+    for (size_t i = 0; i < std::min<size_t>(operations, 1000); ++i) sink += op(i); // Warm up
+    PerfSnapshot before = takePerfSnapshot();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < operations; ++i) sink += op(i);
+    double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+    PerfSnapshot events = takePerfSnapshot() - before;
+    microSink = microSink + sink;
+
+    std::cout << "  " << std::left << std::setw(26) << name << std::right << std::fixed
+              << std::setw(10) << std::setprecision(1) << nanoseconds / operations
+              << std::setw(12) << std::setprecision(3) << static_cast<double>(events[PerfEvent::Allocation]) / operations
+              << std::endl;
+}
+
+// Run the micro-benchmarks and print the report; --bench-scale N does N times fewer calls
+int runMicroBenchmarks(unsigned scale) {
+    MicroEntries synthetic(4096);
+    const std::vector<DirEntry>& entries = synthetic.entries;
+    const size_t mask = entries.size() - 1;
+    const size_t operations = 2000000 / scale;
+
+    std::vector<std::string> names;
+    std::vector<std::uintmax_t> sizes;
+    std::vector<fs::file_time_type> times;
+    BenchRandom random(20250504);
+    auto now = fs::file_time_type::clock::now();
+    for (const auto& entry : entries) {
+        names.emplace_back(entry.name);
+        sizes.push_back(random.below(std::uint64_t(1) << random.below(50)));
+        times.push_back(now - std::chrono::seconds(random.below(300000000)));
+    }
+
+    PatternMatcher suffix("*.log"), prefix("ab*"), inSet("*[!0-9]*"), general("*_1?.[ch]*");
+    PatternMatcher anyOf;
+    anyOf.compile(std::vector<std::string>{"*.h", "*.cpp", "*.py"});
+
+    output().setLineFlush(false);
+    setPerfCounting(true);
+    std::cout << "ColorDir micro-benchmarks (" << operations << " calls each, " << entries.size()
+              << " synthetic entries)" << std::endl;
+    std::cout << "  " << std::left << std::setw(26) << "function" << std::right << std::setw(10) << "ns/op"
+              << std::setw(12) << "alloc/op" << std::endl;
+
+    benchOperation("formatSize", operations, [&](size_t i) { return formatSize(sizes[i & mask]).size(); });
+    benchOperation("formatSizeTo", operations, [&](size_t i) {
+        char text[sizeTextCapacity];
+        return formatSizeTo(text, sizes[i & mask]) + static_cast<unsigned char>(text[0]);
+    });
+    benchOperation("getPermissions", operations, [&](size_t i) { return getPermissions(entries[i & mask])[3]; });
+    benchOperation("categorizeFile", operations, [&](size_t i) {
+        return static_cast<size_t>(categorizeFile(entries[i & mask]));
+    });
+    benchOperation("toLower", operations, [&](size_t i) { return toLower(names[i & mask]).size(); });
+    benchOperation("to_time_t", operations, [&](size_t i) {
+        return static_cast<std::uint64_t>(to_time_t(times[i & mask]));
+    });
+    benchOperation("displayWidth", operations, [&](size_t i) { return displayWidth(entries[i & mask].name); });
+    benchOperation("TimestampFormatter", operations, [&](size_t i) {
+        static TimestampFormatter timestamps;
+        char text[timestampTextCapacity];
+        return timestamps.format(text, entries[i & mask].mtime) + static_cast<unsigned char>(text[0]);
+    });
+
+    // The filter: each fast path of the matcher, and fnmatch on the same pattern for comparison
+    const struct {
+        const char* label;
+        const char* fnmatchLabel;
+        const PatternMatcher* matcher;
+    } filters[] = {
+        {"match \"*.log\"", "fnmatch \"*.log\"", &suffix},
+        {"match \"ab*\"", "fnmatch \"ab*\"", &prefix},
+        {"match \"*[!0-9]*\"", "fnmatch \"*[!0-9]*\"", &inSet},
+        {"match \"*_1?.[ch]*\"", nullptr, &general},
+        {"match *.h *.cpp *.py", nullptr, &anyOf},
+    };
+    for (const auto& filter : filters) {
+        const PatternMatcher& matcher = *filter.matcher;
+        benchOperation(filter.label, operations, [&](size_t i) {
+            const DirEntry& entry = entries[i & mask];
+            return static_cast<size_t>(matcher.matches(entry.name.data(), entry.name.size()));
+        });
+        if (!filter.fnmatchLabel) continue;
+        benchOperation(filter.fnmatchLabel, operations, [&](size_t i) {
+            return static_cast<size_t>(fnmatch(matcher.pattern().c_str(), entries[i & mask].name.data(), FNM_PATHNAME) == 0);
+        });
+    }
+
+    // The render functions, per entry, with the output sent to /dev/null
+    {
+        NullStdout discard;
+        benchOperation("printEntry", operations, [&](size_t i) { return printEntry(entries[i & mask], false); });
+        benchOperation("printRecord (json)", operations, [&](size_t i) {
+            printRecord(entries[i & mask], "/tmp", OutputFormat::Json);
+            return size_t(1);
+        });
+    }
+
+    setPerfCounting(false);
+    return 0;
+}
+
+// Outcome of the self-checks; every failure is reported as it is found
+class CheckReport {
+public:
+    // Print that a check passed (or how often it failed)
+    void finish(const char* name, size_t cases) {
+        std::cout << "  " << std::left << std::setw(30) << name << std::right << std::setw(9) << cases << " cases  "
+                  << (currentFailures ? "FAILED" : "ok") << std::endl;
+        failures += currentFailures;
+        currentFailures = 0;
+    }
+
+    // Report one failure; only the first few of a check are printed
+    void fail(const std::string& what) {
+        if (currentFailures++ < 5) std::cout << "  FAILED: " << what << std::endl;
+    }
+
+    bool passed() const { return failures == 0; }
+
+private:
+    size_t failures = 0;
+    size_t currentFailures = 0;
+};
+
+// Bytes shown in a failure message: printable ASCII as is, anything else as \xNN
+inline std::string printableBytes(std::string_view text) {
+    static const char digits[] = "0123456789abcdef";
+    std::string shown;
+    for (unsigned char c : text) {
+        if (c >= 0x20 && c < 0x7f && c != '\\') {
+            shown += static_cast<char>(c);
+        } else {
+            shown += "\\x";
+            shown += digits[c >> 4];
+            shown += digits[c & 15];
+        }
+    }
+    return shown;
+}
+
+// Render loops: the second pass over the same entries must not allocate
+void checkRenderAllocations(CheckReport& report, const std::vector<DirEntry>& entries) {
+    struct Loop {
+        const char* name;
+        void (*run)(const std::vector<DirEntry>&);
+    };
+    static const Loop loops[] = {
+        {"render: list view", [](const std::vector<DirEntry>& list) {
+             for (const auto& entry : list) printEntry(entry, false);
+         }},
+        {"render: list view with -t", [](const std::vector<DirEntry>& list) {
+             for (const auto& entry : list) printEntry(entry, true);
+         }},
+        {"render: multi-column view", [](const std::vector<DirEntry>& list) {
+             displayMultiColumn(EntryRange{list.data(), list.size()});
+         }},
+        {"render: json records", [](const std::vector<DirEntry>& list) {
+             static const fs::path parent("/some/directory");
+             for (const auto& entry : list) printRecord(entry, parent, OutputFormat::Json);
+         }},
+        {"render: -0 records", [](const std::vector<DirEntry>& list) {
+             static const fs::path parent("/some/directory/");
+             for (const auto& entry : list) printRecord(entry, parent, OutputFormat::NullSeparated);
+         }},
+        {"render: summary", [](const std::vector<DirEntry>& list) {
+             displaySummary(static_cast<int>(list.size()), 1, list.size() * 4096);
+         }},
+        {"categorize", [](const std::vector<DirEntry>& list) {
+             std::uint64_t sink = 0;
+             for (const auto& entry : list) sink += static_cast<std::uint64_t>(categorizeFile(entry));
+             microSink = microSink + sink;
+         }},
+        {"sort (every order)", [](const std::vector<DirEntry>& list) {
+             static std::vector<DirEntry> sorted;
+             for (SortOrder order : {SortOrder::Type, SortOrder::Name, SortOrder::Size, SortOrder::Mtime,
+                                     SortOrder::Extension, SortOrder::None}) {
+                 sorted.assign(list.begin(), list.end());
+                 sortEntries(sorted.data(), sorted.size(), order);
+             }
+         }},
+    };
+
+    bool savedColors = colorOutput;
+    for (const auto& loop : loops) {
+        for (bool colors : {true, false}) {
+            colorOutput = colors;
+            std::uint64_t allocations;
+            {
+                NullStdout discard;
+                loop.run(entries); // Grows the buffers to their steady-state size
+                PerfSnapshot before = takePerfSnapshot();
+                loop.run(entries);
+                allocations = (takePerfSnapshot() - before)[PerfEvent::Allocation];
+            }
+            if (allocations > 0) {
+                report.fail(std::string(loop.name) + (colors ? " (colors)" : " (no colors)") + ": " +
+                            std::to_string(allocations) + " allocations for " + std::to_string(entries.size()) + " entries");
+            }
+        }
+        report.finish(loop.name, entries.size());
+    }
+    colorOutput = savedColors;
+}
+
+// PatternMatcher must agree with fnmatch(FNM_PATHNAME), which it replaces with its fast paths
+void checkPatterns(CheckReport& report, BenchRandom& random) {
+    static const char* const pieces[] = {"*", "*", "?", "a", "b", "B", ".", "-", "]", "[", "\\", "\\*", "[ab]",
+                                         "[!a]", "[^b]", "[a-c]", "[!0-9]", "[]a]", "[a-]", "[.]", "[[:alpha:]]"};
+    static const char letters[] = "aAbBc.-]*?[\\09 ";
+    const size_t cases = 200000;
+    for (size_t n = 0; n < cases; ++n) {
+        std::string pattern;
+        size_t count = 1 + random.below(5);
+        if (random.below(4) == 0) pattern += '*'; // The shapes of the fast paths are common
+        for (size_t i = 0; i < count; ++i) pattern += pieces[random.below(sizeof(pieces) / sizeof(pieces[0]))];
+        if (random.below(4) == 0) pattern += '*';
+
+        PatternMatcher matcher(pattern);
+        for (int k = 0; k < 8; ++k) {
+            std::string name;
+            size_t length = random.below(9);
+            for (size_t i = 0; i < length; ++i) name += letters[random.below(sizeof(letters) - 1)];
+            bool expected = fnmatch(pattern.c_str(), name.c_str(), FNM_PATHNAME) == 0;
+            if (matcher.matches(name) != expected) {
+                report.fail("pattern \"" + printableBytes(pattern) + "\" on \"" + printableBytes(name) + "\": " +
+                            (expected ? "fnmatch matches" : "fnmatch doesn't match"));
+            }
+        }
+    }
+    report.finish("match vs fnmatch", cases * 8);
+
+    // Several patterns: any of them
+    for (size_t n = 0; n < cases / 10; ++n) {
+        std::vector<std::string> patterns(2 + random.below(2));
+        for (auto& pattern : patterns) {
+            pattern = random.below(2) ? "*" : "";
+            pattern += pieces[random.below(sizeof(pieces) / sizeof(pieces[0]))];
+            pattern += random.below(2) ? "*" : "";
+        }
+        PatternMatcher matcher;
+        matcher.compile(patterns);
+        std::string name;
+        size_t length = random.below(7);
+        for (size_t i = 0; i < length; ++i) name += letters[random.below(sizeof(letters) - 1)];
+        bool expected = false;
+        for (const auto& pattern : patterns) expected |= fnmatch(pattern.c_str(), name.c_str(), FNM_PATHNAME) == 0;
+        if (matcher.matches(name) != expected) {
+            report.fail("patterns \"" + printableBytes(matcher.pattern()) + "\" on \"" + printableBytes(name) + "\"");
+        }
+    }
+    report.finish("match several vs fnmatch", cases / 10);
+}
+
+// File headers: random bytes, truncated magic numbers and cut-off text
+void checkHeaders(CheckReport& report, BenchRandom& random) {
+    const size_t cases = 100000;
+    for (size_t n = 0; n < cases; ++n) {
+        // A buffer of exactly the header's length, so a sanitizer sees any read past it
+        size_t length = random.below(sniffHeaderSize + 1);
+        std::vector<unsigned char> header(length);
+        for (auto& byte : header) byte = static_cast<unsigned char>(random.next());
+        if (length > 0 && random.below(2) == 0) {
+            // Start with (a part of) a real signature
+            const MagicRule& rule = magicRules[random.below(sizeof(magicRules) / sizeof(magicRules[0]))];
+            size_t end = std::min(length, rule.offset + rule.bytes.size());
+            for (size_t i = rule.offset; i < end; ++i) header[i] = static_cast<unsigned char>(rule.bytes[i - rule.offset]);
+        }
+        FileType type = classifyHeader(header.data(), header.size(), random.below(2) == 0);
+        if (static_cast<size_t>(type) >= fileTypeCount) report.fail("classifyHeader returned an invalid type");
+    }
+
+    // Valid UTF-8 text, cut anywhere: still text if the header is only the start of the file
+    static const char* const characters[] = {"a", " ", "\n", "\t", "Z", "\xc3\xa9", "\xe2\x82\xac",
+                                             "\xe6\x97\xa5", "\xf0\x9f\x90\xa7", "\x1b[0m"};
+    for (size_t n = 0; n < cases; ++n) {
+        std::string text;
+        while (text.size() < 40) text += characters[random.below(sizeof(characters) / sizeof(characters[0]))];
+        size_t cut = 1 + random.below(text.size());
+        const auto* bytes = reinterpret_cast<const unsigned char*>(text.data());
+        if (!looksLikeText(bytes, cut, true)) report.fail("cut-off text \"" + printableBytes(text.substr(0, cut)) + "\"");
+        if (!looksLikeText(bytes, text.size(), false)) report.fail("text \"" + printableBytes(text) + "\"");
+    }
+    report.finish("file headers", cases * 2);
+}
+
+// Sizes: results fit formatSizeTo's buffer and are the size to 4 significant digits
+void checkSizes(CheckReport& report, BenchRandom& random) {
+    static const char* const units[] = {"B", "KB", "MB", "GB", "TB", "PB", "EB"};
+    const size_t cases = 100000;
+    for (size_t n = 0; n < cases; ++n) {
+        std::uintmax_t size;
+        switch (n) {
+            case 0: size = 0; break;
+            case 1: size = UINTMAX_MAX; break;
+            case 2: size = 1023; break;
+            case 3: size = 1024 * 1024 - 1; break;
+            default: {
+                unsigned bits = static_cast<unsigned>(random.below(65));
+                size = bits == 64 ? random.next() : random.next() & ((std::uintmax_t(1) << bits) - 1);
+            }
+        }
+
+        char text[sizeTextCapacity + 8];
+        std::memset(text, '#', sizeof(text));
+        size_t length = formatSizeTo(text, size);
+        std::string shown(text, std::min(length, sizeTextCapacity));
+        if (length > sizeTextCapacity || text[sizeTextCapacity] != '#') {
+            report.fail("formatSizeTo(" + std::to_string(size) + ") wrote past its buffer");
+            continue;
+        }
+        if (formatSize(size) != shown) report.fail("formatSize(" + std::to_string(size) + ") differs from formatSizeTo");
+
+        // "1.234 MB": parse it back and compare with the size
+        char* end = nullptr;
+        double value = std::strtod(shown.c_str(), &end);
+        size_t unit = 0;
+        while (unit < sizeof(units) / sizeof(units[0]) && std::strcmp(end, (std::string(" ") + units[unit]).c_str()) != 0) ++unit;
+        double scaled = static_cast<double>(size);
+        for (size_t i = 0; i < unit; ++i) scaled /= 1024;
+        bool wellFormed = end != shown.c_str() && unit < sizeof(units) / sizeof(units[0]);
+        if (!wellFormed || (unit == 0 ? value != scaled : std::abs(value - scaled) > scaled * 0.0006)) {
+            report.fail("formatSize(" + std::to_string(size) + ") = \"" + shown + "\"");
+        }
+    }
+    report.finish("formatSize", cases);
+}
+
+// Text widths: random bytes, valid UTF-8 and emoji sequences
+void checkWidths(CheckReport& report, BenchRandom& random) {
+    static const char* const pieces[] = {"a", "Z", "\xc3\xa9", "\xe6\x97\xa5", "\xf0\x9f\x90\xa7", "\xe2\x80\x8d",
+                                         "\xef\xb8\x8f", "\xf0\x9f\x8f\xbd", "\xcc\x81", "\xff", "\xc3", "\xe2\x82",
+                                         "\xf0\x9f\x90", "\x80", "\xed\xa0\x80", "\xc0\xaf"};
+    const size_t cases = 100000;
+    for (size_t n = 0; n < cases; ++n) {
+        std::string text;
+        size_t count = random.below(12);
+        for (size_t i = 0; i < count; ++i) text += pieces[random.below(sizeof(pieces) / sizeof(pieces[0]))];
+        size_t maxWidth = random.below(16);
+
+        FittedText fitted = fitWidth(text, maxWidth);
+        FittedText whole = fitWidth(text, SIZE_MAX);
+        bool valid = fitted.length <= text.size() && fitted.width <= maxWidth && whole.length == text.size();
+        // The start it keeps is measured the same on its own, and allowing more never keeps less
+        valid = valid && fitWidth(std::string_view(text).substr(0, fitted.length), SIZE_MAX).width == fitted.width;
+        valid = valid && fitWidth(text, maxWidth + 1).length >= fitted.length;
+        if (!valid) report.fail("fitWidth(\"" + printableBytes(text) + "\", " + std::to_string(maxWidth) + ")");
+    }
+    report.finish("text widths", cases);
+}
+
+// Extensions: the category of a name doesn't depend on letter case or on what comes before the
+// extension, and long or dotted names are handled like any other
+void checkExtensions(CheckReport& report, BenchRandom& random) {
+    static const char* const parts[] = {".tar", ".gz", ".TAR", ".Gz", ".cpp", ".H", ".txt", ".mp4", ".JPEG", ".",
+                                        "..", "a", "file", ".x", ".tar.gz.", "\xc3\x89", ".Verilog"};
+    const size_t cases = 100000;
+    for (size_t n = 0; n < cases; ++n) {
+        std::string name;
+        size_t count = 1 + random.below(5);
+        for (size_t i = 0; i < count; ++i) name += parts[random.below(sizeof(parts) / sizeof(parts[0]))];
+        if (random.below(20) == 0) name += std::string(random.below(300), '.');
+
+        FileType type = FileType::Other;
+        bool known = classifyExtension(name.data(), name.size(), type);
+
+        std::string flipped = name;
+        for (auto& c : flipped) {
+            if (random.below(2)) c = static_cast<char>(foldCase(static_cast<unsigned char>(c)));
+            else if (c >= 'a' && c <= 'z') c = static_cast<char>(c - 'a' + 'A');
+        }
+        FileType flippedType = FileType::Other;
+        bool flippedKnown = classifyExtension(flipped.data(), flipped.size(), flippedType);
+
+        // Only the text from the second to last dot on is looked at (a leading dot doesn't count)
+        size_t last = name.rfind('.');
+        if (last == 0 || last == std::string::npos) {
+            if (known) report.fail("\"" + printableBytes(name) + "\" has no extension but a category");
+            continue;
+        }
+        size_t previous = last > 1 ? name.rfind('.', last - 1) : std::string::npos;
+        std::string renamed = "stem" + name.substr(previous != std::string::npos && previous > 0 ? previous : last);
+        FileType renamedType = FileType::Other;
+        bool renamedKnown = classifyExtension(renamed.data(), renamed.size(), renamedType);
+        if (renamedKnown != known || (known && renamedType != type)) {
+            report.fail("\"" + printableBytes(name) + "\" and \"" + printableBytes(renamed) + "\" differ");
+        }
+        if (flippedKnown != known || (known && flippedType != type)) {
+            report.fail("\"" + printableBytes(name) + "\" and \"" + printableBytes(flipped) + "\" differ");
+        }
+    }
+    report.finish("extensions", cases);
+}
+
+// Sorting: a permutation, directories first, each order kept, and the same on several threads
+void checkSorting(CheckReport& report, const std::vector<DirEntry>& entries) {
+    auto folded = [](std::string_view name) {
+        std::string text;
+        for (char c : name) text.push_back(static_cast<char>(foldCase(static_cast<unsigned char>(c))));
+        return text;
+    };
+    auto namesOf = [](const std::vector<DirEntry>& list) {
+        std::vector<std::string_view> names;
+        for (const auto& entry : list) names.push_back(entry.name);
+        std::sort(names.begin(), names.end());
+        return names;
+    };
+    const std::vector<std::string_view> expectedNames = namesOf(entries);
+
+    size_t cases = 0;
+    for (SortOrder order : {SortOrder::Type, SortOrder::Name, SortOrder::Size, SortOrder::Mtime,
+                            SortOrder::Extension, SortOrder::None}) {
+        std::vector<DirEntry> sorted = entries;
+        sortEntries(sorted.data(), sorted.size(), order);
+        cases++;
+        std::string label = "order " + std::to_string(static_cast<int>(order));
+        if (namesOf(sorted) != expectedNames) report.fail(label + ": not a permutation of the entries");
+        auto firstFile = std::find_if(sorted.begin(), sorted.end(), [](const DirEntry& e) { return !e.isDirectory; });
+        if (std::any_of(firstFile, sorted.end(), [](const DirEntry& e) { return e.isDirectory; })) {
+            report.fail(label + ": a directory after the files");
+        }
+        for (size_t i = 1; i < sorted.size(); ++i) {
+            const DirEntry& a = sorted[i - 1];
+            const DirEntry& b = sorted[i];
+            if (a.isDirectory != b.isDirectory) continue;
+            bool inOrder = true;
+            if (order == SortOrder::Name) inOrder = folded(a.name) <= folded(b.name);
+            else if (order == SortOrder::Size) inOrder = a.isDirectory || a.size >= b.size;
+            else if (order == SortOrder::Mtime) inOrder = a.mtime >= b.mtime;
+            if (!inOrder) report.fail(label + ": \"" + printableBytes(a.name) + "\" before \"" + printableBytes(b.name) + "\"");
+        }
+
+        // Big enough for the parallel sort, which has to give the same result
+        std::vector<DirEntry> many;
+        while (many.size() < parallelSortThreshold * 2) many.insert(many.end(), entries.begin(), entries.end());
+        std::vector<DirEntry> parallel = many;
+        sortEntries(many.data(), many.size(), order);
+        sortEntries(parallel.data(), parallel.size(), order, SIZE_MAX, 4);
+        cases++;
+        bool same = std::equal(many.begin(), many.end(), parallel.begin(), [](const DirEntry& a, const DirEntry& b) {
+            return a.name.data() == b.name.data();
+        });
+        if (!same) report.fail(label + ": 4 threads sort differently");
+    }
+    report.finish("sorting", cases);
+}
+
+// Output of this program run with some arguments (empty if it couldn't be run)
+inline std::string listingOutput(const std::vector<std::string>& arguments) {
+    int pipeFds[2];
+    if (pipe2(pipeFds, O_CLOEXEC) != 0) return {};
+    output().flush();
+    std::cout.flush();
+    pid_t child = fork();
+    if (child == 0) {
+        dup2(pipeFds[1], STDOUT_FILENO);
+        std::vector<char*> argv;
+        static char self[] = "c";
+        argv.push_back(self);
+        for (const auto& argument : arguments) argv.push_back(const_cast<char*>(argument.c_str()));
+        argv.push_back(nullptr);
+        execv("/proc/self/exe", argv.data());
+        _exit(127);
+    }
+    ::close(pipeFds[1]);
+    std::string text;
+    char chunk[4096];
+    ssize_t got;
+    while (child > 0 && (got = ::read(pipeFds[0], chunk, sizeof chunk)) > 0) text.append(chunk, static_cast<size_t>(got));
+    ::close(pipeFds[0]);
+    int status = 0;
+    if (child < 0 || waitpid(child, &status, 0) != child || !WIFEXITED(status) || WEXITSTATUS(status) != 0) return {};
+    return text;
+}
+
+// Hard links: which link of a file carries its blocks must not depend on the order in which
+// the threads come across them, so -j 1 and -j 8 have to agree, run after run
+void checkHardLinks(CheckReport& report, BenchRandom& random) {
+    char pattern[] = "/tmp/colordir-check-XXXXXX";
+    if (!mkdtemp(pattern)) {
+        report.fail("links: can't create a directory in /tmp");
+        report.finish("links: -j 1 and -j 8", 0);
+        return;
+    }
+    const std::string root = pattern;
+    std::error_code removed;
+
+    // Files of different sizes in nested directories, each linked from two or three others
+    std::vector<std::string> directories;
+    for (int top = 0; top < 4; ++top) {
+        for (int sub = 0; sub < 4; ++sub) {
+            std::string path = root + "/d" + std::to_string(top) + "/s" + std::to_string(sub);
+            std::error_code created;
+            fs::create_directories(path, created);
+            if (created) {
+                report.fail("links: can't create " + path + ": " + created.message());
+                fs::remove_all(root, removed);
+                report.finish("links: -j 1 and -j 8", 0);
+                return;
+            }
+            directories.push_back(path);
+        }
+    }
+    std::string data(64 * 1024, 'x');
+    for (size_t i = 0; i < 160; ++i) {
+        std::string file = directories[i % directories.size()] + "/f" + std::to_string(i);
+        int fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        size_t size = 4096 * (1 + random.below(16));
+        bool written = fd >= 0 && ::write(fd, data.data(), size) == static_cast<ssize_t>(size);
+        if (fd >= 0) ::close(fd);
+        if (!written) {
+            report.fail("links: can't write " + file);
+            continue;
+        }
+        for (size_t link = 0; link < 1 + i % 2; ++link) {
+            std::string name = directories[random.below(directories.size())] + "/l" + std::to_string(i) + "_" + std::to_string(link);
+            if (::link(file.c_str(), name.c_str()) != 0) report.fail("links: can't link " + name);
+        }
+    }
+
+    size_t cases = 0;
+    const std::vector<std::vector<std::string>> listings = {
+        {"-l", "-t", "--disk-usage"},
+        {"--top", "5", "--disk-usage"},
+    };
+    for (const auto& listing : listings) {
+        std::string label;
+        for (const auto& argument : listing) label += (label.empty() ? "" : " ") + argument;
+        std::vector<std::string> arguments = listing;
+        arguments.insert(arguments.end(), {"-j", "1", root + "/d0", root + "/d1", root + "/d2", root + "/d3"});
+        const std::string serial = listingOutput(arguments);
+        if (serial.empty()) report.fail("links: " + label + " -j 1 didn't run");
+        arguments[listing.size() + 1] = "8";
+        for (int run = 0; run < 4 && !serial.empty(); ++run) {
+            cases++;
+            if (listingOutput(arguments) != serial) report.fail("links: " + label + " -j 8 differs from -j 1");
+        }
+    }
+    fs::remove_all(root, removed);
+    report.finish("links: -j 1 and -j 8", cases);
+}
+
+// Run every check, returns the exit status (1 if one failed)
+int runSelfChecks() {
+    MicroEntries synthetic(4096);
+    CheckReport report;
+    BenchRandom random(20250505);
+
+    output().setLineFlush(false);
+    setPerfCounting(true);
+    std::cout << "ColorDir self-checks" << std::endl;
+    checkRenderAllocations(report, synthetic.entries);
+    setPerfCounting(false);
+
+    checkPatterns(report, random);
+    checkHeaders(report, random);
+    checkSizes(report, random);
+    checkWidths(report, random);
+    checkExtensions(report, random);
+    checkSorting(report, synthetic.entries);
+    checkHardLinks(report, random);
+
+    std::cout << (report.passed() ? "All checks passed" : "Some checks FAILED") << std::endl;
+    return report.passed() ? 0 : 1;
+}
+
+#endif // MICRO_H
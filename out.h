@@ -0,0 +1,217 @@
+// out.h 🐧
+//
+// Buffered output writer for ColorDir.
+// Lines are formatted into one large reusable buffer and written out in big chunks, instead
+// of one write per field or per std::endl. Line flushing is only used when somebody is
+// watching the output as it arrives (an interactive terminal or --pause). With --pause the
+// text goes to a PageSink (pager.h) instead, together with the position of every screen end.
+// Screens are counted in terminal rows: a line as wide as three terminal lines (a long name in
+// the list view) takes three rows, and a line that doesn't fit on the screen any more starts
+// the next one.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef OUT_H
+#define OUT_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include <unistd.h>
+#include "perf.h"
+#include "width.h"
+
+// Write a whole block to a file descriptor, retrying after signals
+// Returns false if the output was closed (e.g. the pager quit); the rest is dropped
+bool writeAll(int fd, const char* data, size_t length) {
+    PhaseScope phase(Phase::Write);
+    while (length > 0) {
+        countEvent(PerfEvent::Write);
+        countEvent(PerfEvent::WrittenBytes, length);
+        ssize_t written = ::write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += written;
+        length -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// Receives the output screen by screen instead of the file descriptor (see pager.h)
+class PageSink {
+public:
+    virtual ~PageSink() = default;
+    virtual int pageRows() const = 0;                                      // Rows per screen
+    virtual int pageColumns() const = 0;                                   // Columns of a row
+    virtual void write(const char* data, size_t length, bool pageEnd) = 0; // pageEnd: a screen is full
+    virtual bool closed() const { return false; }                          // The reader quit
+};
+
+class OutputWriter {
+public:
+    explicit OutputWriter(int fd = STDOUT_FILENO, size_t capacity = 256 * 1024)
+        : fd(fd), buffer(capacity) {}
+    ~OutputWriter() { flush(); }
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter& operator=(const OutputWriter&) = delete;
+
+    // Flush after every line (interactive output) or only when the buffer is full
+    void setLineFlush(bool enabled) { lineFlush = enabled; }
+
+    // Send the output to a pager (nullptr: straight to the file descriptor again)
+    void setPageSink(PageSink* sink) {
+        flush();
+        pages = sink;
+        rows = 0;
+        lineBegin = measured = lineColumns = 0;
+        escape = Escape::None;
+    }
+
+    // Append raw bytes
+    void write(const char* data, size_t length) {
+        if (length > buffer.size() - used) {
+            flush();
+            if (length > buffer.size()) {
+                if (pages) {
+                    measure(data, length);
+                    lineBegin = npos; // The line no longer starts in the buffer
+                }
+                emit(data, length, false); // Too big to buffer, write it directly
+                return;
+            }
+        }
+        std::memcpy(buffer.data() + used, data, length);
+        used += length;
+    }
+
+    void write(std::string_view text) { write(text.data(), text.size()); }
+
+    // Append a single character
+    void put(char c) {
+        if (used == buffer.size()) flush();
+        buffer[used++] = c;
+    }
+
+    // Append the same text count times (e.g. a line of box-drawing characters)
+    void repeat(std::string_view text, size_t count) {
+        for (size_t i = 0; i < count; ++i) write(text);
+    }
+
+    // Append text left-aligned in a field of the given width, like std::setw with std::left
+    void pad(std::string_view text, size_t width) {
+        write(text);
+        for (size_t i = text.size(); i < width; ++i) put(' ');
+    }
+
+    // Same for text that takes textWidth terminal columns (see width.h), which may not be its size
+    void pad(std::string_view text, size_t textWidth, size_t width) {
+        write(text);
+        for (size_t i = textWidth; i < width; ++i) put(' ');
+    }
+
+    // End the current line
+    void endLine() {
+        if (!pages) {
+            put('\n');
+            if (lineFlush) flush();
+            return;
+        }
+
+        measurePending();
+        put('\n');
+        int columns = std::max(1, pages->pageColumns());
+        int lineRows = std::max<int>(1, static_cast<int>((lineColumns + columns - 1) / columns));
+        lineColumns = 0;
+        escape = Escape::None;
+        if (rows > 0 && rows + lineRows > pages->pageRows() && lineBegin != npos) {
+            // The line doesn't fit on this screen any more: the screen ends before it
+            emit(buffer.data(), lineBegin, true);
+            std::memmove(buffer.data(), buffer.data() + lineBegin, used - lineBegin);
+            used -= lineBegin;
+            rows = 0;
+        }
+        rows += lineRows;
+        if (rows >= pages->pageRows()) {
+            rows = 0;
+            emit(buffer.data(), used, true); // A screen is full
+            used = 0;
+        }
+        lineBegin = measured = used;
+        if (lineFlush) flush();
+    }
+
+    // True once the pager was quit: whatever is written now is dropped, so listings stop early
+    bool closed() const { return pages && pages->closed(); }
+
+    // Write everything buffered so far
+    void flush() {
+        if (used == 0) return;
+        if (pages) {
+            measurePending();
+            lineBegin = lineBegin == used ? 0 : npos; // Flushed in the middle of a line: npos
+            measured = 0;
+        }
+        emit(buffer.data(), used, false);
+        used = 0;
+    }
+
+private:
+    static constexpr size_t npos = SIZE_MAX;
+    enum class Escape { None, Start, Csi }; // Where an escape sequence (colors) is being measured
+
+    // Add the buffered text that was not measured yet to the width of the current line
+    void measurePending() {
+        measure(buffer.data() + measured, used - measured);
+        measured = used;
+    }
+
+    // Add the terminal columns of text to the width of the current line; escape sequences
+    // take none, and one may continue in the next part of the line
+    void measure(const char* data, size_t length) {
+        size_t run = 0; // Start of the text between escape sequences
+        for (size_t i = 0; i < length; ++i) {
+            if (escape == Escape::None) {
+                if (data[i] != '\033') continue;
+                lineColumns += displayWidth(std::string_view(data + run, i - run));
+                escape = Escape::Start;
+            } else if (escape == Escape::Start) {
+                escape = data[i] == '[' ? Escape::Csi : Escape::None; // Else a two-byte sequence
+            } else if (data[i] >= 0x40 && data[i] <= 0x7e) {
+                escape = Escape::None; // Final byte of "\033[...m"
+            }
+            run = i + 1;
+        }
+        if (escape == Escape::None) lineColumns += displayWidth(std::string_view(data + run, length - run));
+    }
+
+    void emit(const char* data, size_t length, bool pageEnd) {
+        if (pages) pages->write(data, length, pageEnd);
+        else writeAll(fd, data, length);
+    }
+
+    int fd;                    // Destination file descriptor
+    std::vector<char> buffer;  // Pending output
+    size_t used = 0;           // Number of bytes pending in the buffer
+    bool lineFlush = false;    // Flush at the end of every line
+    PageSink* pages = nullptr; // Pager receiving the output, if any
+    int rows = 0;              // Terminal rows written on the current screen
+    size_t lineBegin = 0;      // Where the current line starts in the buffer (npos: written out already)
+    size_t measured = 0;       // Bytes of the buffer already added to lineColumns
+    size_t lineColumns = 0;    // Terminal columns of the current line so far
+    Escape escape = Escape::None;
+};
+
+// Writer used for everything the listing prints to standard output
+OutputWriter& output() {
+    static OutputWriter writer;
+    return writer;
+}
+
+#endif // OUT_H
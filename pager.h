@@ -0,0 +1,203 @@
+// pager.h 🐧
+//
+// Screen-by-screen output for ColorDir (-p, --pause).
+// The output writer hands its buffered text to the pager instead of writing it out, marking
+// where every screen ends. A separate thread writes the text to the terminal and waits for a
+// key at each screen boundary, so the listing keeps being scanned and rendered ahead while
+// the user is reading; when they press a key the next screen is already there.
+// The terminal is switched to raw mode once for the whole session and restored on exit,
+// including when the program is interrupted. Pressing q closes the pager: everything written
+// after that is dropped, and the listing stops at its next directory (see closed()), so the
+// program still ends the normal way (--index is saved, --stats reported).
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef PAGER_H
+#define PAGER_H
+
+#include <atomic>
+#include <csignal>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include "hdir.h"
+
+// Puts a terminal into raw mode (no line buffering, no echo) for its lifetime
+class TerminalRawMode {
+public:
+    explicit TerminalRawMode(int fd) : fd(fd) {
+        if (tcgetattr(fd, &saved) != 0) return;
+        struct termios raw = saved;
+        raw.c_lflag &= ~(ICANON | ECHO); // Disable canonical mode and echo
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        if (tcsetattr(fd, TCSANOW, &raw) != 0) return;
+        active = true;
+
+        // Ctrl-C (or a kill) while paused must not leave the terminal without echo
+        signalFd = fd;
+        signalSaved = saved;
+        for (int signalNumber : {SIGINT, SIGTERM, SIGQUIT, SIGHUP}) std::signal(signalNumber, restoreAndRaise);
+    }
+
+    ~TerminalRawMode() { restore(); }
+
+    TerminalRawMode(const TerminalRawMode&) = delete;
+    TerminalRawMode& operator=(const TerminalRawMode&) = delete;
+
+    bool isActive() const { return active; }
+
+    // Put the original settings back (safe to call more than once)
+    void restore() {
+        if (!active) return;
+        tcsetattr(fd, TCSANOW, &saved);
+        for (int signalNumber : {SIGINT, SIGTERM, SIGQUIT, SIGHUP}) std::signal(signalNumber, SIG_DFL);
+        active = false;
+    }
+
+private:
+    // Signal handler: only async-signal-safe calls
+    static void restoreAndRaise(int signalNumber) {
+        tcsetattr(signalFd, TCSANOW, &signalSaved);
+        std::signal(signalNumber, SIG_DFL);
+        raise(signalNumber);
+    }
+
+    int fd;
+    struct termios saved {};
+    bool active = false;
+
+    static inline int signalFd = -1;             // Terminal to restore from the signal handler
+    static inline struct termios signalSaved {}; // Its original settings
+};
+
+class Pager : public PageSink {
+public:
+    // Page the output for a terminal of the given size, reading keys from /dev/tty
+    Pager(int screenHeight, int screenWidth)
+        : rows(std::max(1, screenHeight - 1)), // Keep the last row for the prompt
+          columns(std::max(1, screenWidth)),
+          ttyFd(::open("/dev/tty", O_RDONLY | O_CLOEXEC)),
+          rawMode(ttyFd) {
+        if (!rawMode.isActive()) return;
+        worker = std::thread([this] { run(); });
+    }
+
+    ~Pager() {
+        finish();
+        if (ttyFd >= 0) ::close(ttyFd);
+    }
+
+    // False when there is no terminal to page on; the output should then go out directly
+    bool active() const { return worker.joinable(); }
+
+    int pageRows() const override { return rows; }
+    int pageColumns() const override { return columns; }
+
+    // True once the user pressed q: the rest of the output is not wanted
+    bool closed() const override { return quit.load(std::memory_order_relaxed); }
+
+    // Queue output, blocking while too much is already waiting for the user
+    // Once the pager is closed, the output is dropped
+    void write(const char* data, size_t length, bool pageEnd) override {
+        std::unique_lock<std::mutex> lock(mutex);
+        room.wait(lock, [this] { return queuedBytes < maxQueuedBytes || closed(); });
+        if (closed()) return;
+        queue.push_back({std::string(data, length), pageEnd});
+        queuedBytes += length;
+        lock.unlock();
+        available.notify_one();
+    }
+
+    // Write out everything still queued and give the terminal back
+    void finish() {
+        if (!worker.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            finishing = true;
+        }
+        available.notify_one();
+        worker.join();
+        rawMode.restore();
+    }
+
+private:
+    struct Chunk {
+        std::string text;
+        bool pageEnd; // A full screen ends with this chunk
+    };
+
+    // Pager thread: write the queued text and stop at every screen boundary
+    void run() {
+        bool promptPending = false;
+        while (true) {
+            std::unique_lock<std::mutex> lock(mutex);
+            available.wait(lock, [this] { return !queue.empty() || finishing; });
+            if (queue.empty()) return; // Finished; a screen that ends the output needs no prompt
+            Chunk chunk = std::move(queue.front());
+            queue.pop_front();
+            queuedBytes -= chunk.text.size();
+            lock.unlock();
+            room.notify_one();
+
+            // Only ask for a key once there is more to show
+            if (promptPending && !chunk.text.empty()) {
+                if (!waitForKey()) {
+                    close();
+                    return;
+                }
+                promptPending = false;
+            }
+            writeAll(STDOUT_FILENO, chunk.text.data(), chunk.text.size());
+            if (chunk.pageEnd) promptPending = true;
+        }
+    }
+
+    // Show the prompt, wait for a key and erase the prompt again
+    // Returns false if the key was q: the user wants no more output
+    bool waitForKey() {
+        static constexpr std::string_view prompt = "\033[7m-- More -- (q to quit)\033[0m";
+        static constexpr std::string_view erase = "\r\033[K";
+        writeAll(STDOUT_FILENO, prompt.data(), prompt.size());
+        int key = getKeyStroke(ttyFd);
+        writeAll(STDOUT_FILENO, erase.data(), erase.size());
+
+        return key != 'q' && key != 'Q';
+    }
+
+    // Drop what is queued and let the writer go on without blocking; the terminal is given
+    // back by finish(), once the program is done
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quit.store(true, std::memory_order_relaxed);
+            queue.clear();
+            queuedBytes = 0;
+        }
+        room.notify_all();
+    }
+
+    static constexpr size_t maxQueuedBytes = 8 << 20; // Output rendered ahead of the reader
+
+    int rows;                           // Rows shown per screen
+    int columns;                        // Width of the terminal, for lines that wrap
+    int ttyFd;                          // Controlling terminal, for the keystrokes
+    TerminalRawMode rawMode;            // Raw mode for the whole session
+    std::mutex mutex;                   // Guards everything below
+    std::condition_variable available;  // Signals the pager thread: new chunk or finishing
+    std::condition_variable room;       // Signals the writer: queue below its limit
+    std::deque<Chunk> queue;
+    size_t queuedBytes = 0;
+    bool finishing = false;
+    std::atomic<bool> quit{false};      // q was pressed (set with the mutex held, read without)
+    std::thread worker;                 // Started last, once everything above is set up
+};
+
+#endif // PAGER_H
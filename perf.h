@@ -0,0 +1,225 @@
+// perf.h 🐧
+//
+// Event counters and phase timing for ColorDir (used by --bench and --stats).
+// The scanner, the stat helper and the output writer report every system call they make,
+// and the global operator new reports every heap allocation. Counting is off by default and
+// costs one relaxed load per event when it is; each counter sits on its own cache line so
+// that pool workers don't contend on them when it is on.
+// With phase timing on, every thread also charges its wall and CPU time to the phase it is
+// in (PhaseScope), exclusively: time spent in a nested phase is not counted for the outer one.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+#include <new>
+
+// Things that get counted
+enum class PerfEvent {
+    Open,          // Directories opened
+    Getdents,      // getdents64 calls
+    Statx,         // statx calls (or lookups submitted to io_uring)
+    UringEnter,    // io_uring_enter calls
+    Write,         // write calls to the output
+    WrittenBytes,  // Bytes passed to those writes
+    SortedEntries, // Entries passed to sortEntries
+    HeaderRead,    // Files whose first bytes were read by --sniff
+    Allocation,    // operator new calls
+    AllocatedBytes,
+    Count          // Number of events, not an event itself
+};
+
+constexpr size_t perfEventCount = static_cast<size_t>(PerfEvent::Count);
+
+// A copy of all counters at one point in time; subtract two to get the events in between
+struct PerfSnapshot {
+    std::uint64_t values[perfEventCount] = {};
+
+    std::uint64_t operator[](PerfEvent event) const { return values[static_cast<size_t>(event)]; }
+
+    PerfSnapshot operator-(const PerfSnapshot& earlier) const {
+        PerfSnapshot difference;
+        for (size_t i = 0; i < perfEventCount; ++i) difference.values[i] = values[i] - earlier.values[i];
+        return difference;
+    }
+};
+
+struct alignas(64) PerfCounter {
+    std::atomic<std::uint64_t> value{0};
+};
+
+inline std::atomic<bool> perfCountingEnabled{false};
+inline PerfCounter perfCounters[perfEventCount];
+
+// Switch counting on or off (best done while no worker threads are running)
+inline void setPerfCounting(bool enabled) {
+    perfCountingEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+// Record n occurrences of an event
+inline void countEvent(PerfEvent event, std::uint64_t n = 1) {
+    if (perfCountingEnabled.load(std::memory_order_relaxed)) {
+        perfCounters[static_cast<size_t>(event)].value.fetch_add(n, std::memory_order_relaxed);
+    }
+}
+
+inline PerfSnapshot takePerfSnapshot() {
+    PerfSnapshot snapshot;
+    for (size_t i = 0; i < perfEventCount; ++i) {
+        snapshot.values[i] = perfCounters[i].value.load(std::memory_order_relaxed);
+    }
+    return snapshot;
+}
+
+// Parts of a listing that --stats reports separately
+enum class Phase {
+    Other,         // Anything outside the phases below (startup, traversal bookkeeping)
+    Scan,          // Opening and reading directories
+    Stat,          // statx calls for entry metadata
+    Categorize,    // categorizeFile
+    Sniff,         // Reading file headers for --sniff
+    Sort,          // sortEntries
+    Totals,        // -t directory totals (their own reading and stat calls included)
+    Render,        // Formatting entries into the output buffer
+    Write,         // write calls to the output
+    Summary,       // displaySummary
+    Count          // Number of phases, not a phase itself
+};
+
+constexpr size_t phaseCount = static_cast<size_t>(Phase::Count);
+
+inline std::atomic<bool> phaseTimingEnabled{false};
+
+// Time charged to every phase, in nanoseconds
+struct PhaseTimes {
+    std::uint64_t wall[phaseCount] = {};
+    std::uint64_t cpu[phaseCount] = {};
+
+    void merge(const PhaseTimes& other) {
+        for (size_t i = 0; i < phaseCount; ++i) {
+            wall[i] += other.wall[i];
+            cpu[i] += other.cpu[i];
+        }
+    }
+};
+
+// Phase times of threads that have already finished, plus a lock for adding to them
+inline std::mutex finishedPhaseMutex;
+inline PhaseTimes finishedPhaseTimes;
+
+// Per-thread phase bookkeeping; the totals are handed over when the thread ends
+class PhaseClock {
+public:
+    ~PhaseClock() { handOver(); }
+
+    // Switch to a phase, returns the one that was active
+    Phase enter(Phase phase) {
+        charge();
+        Phase previous = current;
+        current = phase;
+        return previous;
+    }
+
+    // Return to the phase that was active before enter()
+    void leave(Phase previous) {
+        charge();
+        current = previous;
+    }
+
+    // Add this thread's times so far to the finished totals
+    void handOver() {
+        charge();
+        std::lock_guard<std::mutex> lock(finishedPhaseMutex);
+        finishedPhaseTimes.merge(times);
+        times = PhaseTimes();
+    }
+
+private:
+    static std::uint64_t now(clockid_t clock) {
+        struct timespec time;
+        clock_gettime(clock, &time);
+        return static_cast<std::uint64_t>(time.tv_sec) * 1000000000ull + static_cast<std::uint64_t>(time.tv_nsec);
+    }
+
+    // Charge the time since the last switch to the current phase
+    void charge() {
+        std::uint64_t wall = now(CLOCK_MONOTONIC);
+        std::uint64_t cpu = now(CLOCK_THREAD_CPUTIME_ID);
+        if (started) {
+            times.wall[static_cast<size_t>(current)] += wall - lastWall;
+            times.cpu[static_cast<size_t>(current)] += cpu - lastCpu;
+        }
+        started = true;
+        lastWall = wall;
+        lastCpu = cpu;
+    }
+
+    Phase current = Phase::Other;
+    bool started = false;
+    std::uint64_t lastWall = 0;
+    std::uint64_t lastCpu = 0;
+    PhaseTimes times;
+};
+
+inline PhaseClock& phaseClock() {
+    static thread_local PhaseClock clock;
+    return clock;
+}
+
+// Charges the time of a block to a phase (does nothing unless phase timing is on)
+class PhaseScope {
+public:
+    explicit PhaseScope(Phase phase) {
+        if (phaseTimingEnabled.load(std::memory_order_relaxed)) {
+            active = true;
+            previous = phaseClock().enter(phase);
+        }
+    }
+
+    ~PhaseScope() {
+        if (active) phaseClock().leave(previous);
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope& operator=(const PhaseScope&) = delete;
+
+private:
+    bool active = false;
+    Phase previous = Phase::Other;
+};
+
+// Counting replacements of the global allocation functions (the array and nothrow forms
+// call these, so they are counted too)
+void* operator new(std::size_t size) {
+    countEvent(PerfEvent::Allocation);
+    countEvent(PerfEvent::AllocatedBytes, size);
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* memory = std::malloc(size)) return memory;
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+// GCC flags free() on memory from operator new, which is exactly what this pair is for
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+#pragma GCC diagnostic pop
+
+#endif // PERF_H
@@ -0,0 +1,158 @@
+// pool.h 🐧
+//
+// Work-stealing thread pool for ColorDir.
+// Every worker owns a task deque: tasks submitted from inside a worker go to the back of its
+// own deque and are taken LIFO (good locality for depth-first traversal), while idle workers
+// steal the oldest tasks from the front of the other deques.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkStealingPool {
+public:
+    using Task = std::function<void()>;
+
+    // Start the given number of workers (at least one)
+    explicit WorkStealingPool(unsigned threadCount) {
+        if (threadCount == 0) threadCount = 1;
+        for (unsigned i = 0; i < threadCount; ++i) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (unsigned i = 0; i < threadCount; ++i) {
+            workers.emplace_back([this, i] { workerLoop(i); });
+        }
+    }
+
+    // Finish all queued work, then stop the workers
+    ~WorkStealingPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        sleepCv.notify_all();
+        for (auto& worker : workers) worker.join();
+    }
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Number of worker threads
+    unsigned size() const { return static_cast<unsigned>(queues.size()); }
+
+    // Index of the calling worker, or -1 when called from a thread outside the pool
+    static int workerIndex() { return currentWorker(); }
+
+    // Queue a task; workers push onto their own deque, other threads spread tasks round-robin
+    void submit(Task task) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        int self = currentWorker();
+        size_t target = (self >= 0 && currentPool() == this)
+            ? static_cast<size_t>(self)
+            : nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size();
+        {
+            std::lock_guard<std::mutex> lock(queues[target]->mutex);
+            queues[target]->tasks.push_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            ++signals;
+        }
+        sleepCv.notify_one();
+    }
+
+    // Block until every submitted task (including tasks they submitted) has finished
+    void wait() {
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        idleCv.wait(lock, [this] { return pending.load(std::memory_order_acquire) == 0; });
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    static int& currentWorker() {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    static WorkStealingPool*& currentPool() {
+        static thread_local WorkStealingPool* pool = nullptr;
+        return pool;
+    }
+
+    // Pop from the back of our own deque, otherwise steal from the front of another one
+    bool takeTask(size_t self, Task& task) {
+        {
+            std::lock_guard<std::mutex> lock(queues[self]->mutex);
+            if (!queues[self]->tasks.empty()) {
+                task = std::move(queues[self]->tasks.back());
+                queues[self]->tasks.pop_back();
+                return true;
+            }
+        }
+        for (size_t offset = 1; offset < queues.size(); ++offset) {
+            WorkerQueue& victim = *queues[(self + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.tasks.empty()) {
+                task = std::move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(size_t self) {
+        currentWorker() = static_cast<int>(self);
+        currentPool() = this;
+        Task task;
+        while (true) {
+            unsigned long seenSignals;
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                seenSignals = signals;
+            }
+            if (takeTask(self, task)) {
+                task();
+                task = nullptr;
+                if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    std::lock_guard<std::mutex> lock(sleepMutex);
+                    idleCv.notify_all();
+                }
+                continue;
+            }
+            // Nothing to do: sleep until a new task is submitted or the pool stops
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepCv.wait(lock, [&] { return stopping || signals != seenSignals; });
+            if (stopping && pending.load(std::memory_order_acquire) == 0) return;
+        }
+    }
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;  // One deque per worker
+    std::vector<std::thread> workers;                  // Worker threads
+    std::atomic<size_t> pending{0};                    // Tasks submitted but not yet finished
+    std::atomic<size_t> nextQueue{0};                  // Round-robin target for external submits
+    std::mutex sleepMutex;                             // Guards signals/stopping for sleeping workers
+    std::condition_variable sleepCv;                   // Wakes idle workers
+    std::condition_variable idleCv;                    // Wakes wait() when pending drops to zero
+    unsigned long signals = 0;                         // Bumped on every submit
+    bool stopping = false;                             // Set by the destructor
+};
+
+#endif // POOL_H
@@ -0,0 +1,141 @@
+// queue.h 🐧
+//
+// Bounded multi-producer multi-consumer queue for ColorDir.
+// Connects the stages of the recursive listing (see RecursiveListing in c.cpp). Pushing and
+// popping are lock-free (Dmitry Vyukov's bounded queue: every cell carries a sequence number
+// that tells producers and consumers whose turn it is), so a stage never waits for a lock
+// held by another. A full queue is the backpressure signal: tryPush fails, and the producer
+// does the work itself instead of queueing even more of it. Only a consumer with nothing to
+// do sleeps, and producers only touch the lock to wake such a sleeper.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+template <typename T>
+class BoundedQueue {
+public:
+    // The capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size *= 2;
+        cells.reset(new Cell[size]);
+        mask = size - 1;
+        for (size_t i = 0; i < size; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Append a value, returns false if the queue is full
+    bool tryPush(T value) {
+        size_t position = enqueuePosition.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+            if (difference == 0) {
+                // seq_cst: ordered against the sleepers check below, see pop()
+                if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_seq_cst,
+                                                          std::memory_order_relaxed)) break;
+            } else if (difference < 0) {
+                return false; // The cell still holds a value from one lap ago: full
+            } else {
+                position = enqueuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(value);
+        cell->sequence.store(position + 1, std::memory_order_release);
+
+        // Wake a consumer that went to sleep on an empty queue
+        if (sleepers.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wakeup.notify_one();
+        }
+        return true;
+    }
+
+    // Take the oldest value, returns false if the queue is empty
+    bool tryPop(T& value) {
+        size_t position = dequeuePosition.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[position & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position + 1);
+            if (difference == 0) {
+                if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+            } else if (difference < 0) {
+                return false; // Nothing was stored in this cell yet: empty
+            } else {
+                position = dequeuePosition.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(cell->value);
+        cell->sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Take the oldest value, sleeping while the queue is empty
+    // Returns false once the queue has been closed and is empty
+    // A sleeper is announced before the queue is checked again, and a producer checks for
+    // sleepers after claiming its cell (all seq_cst), so at least one of them sees the other:
+    // either this finds the value (or a push in progress), or the producer wakes it up.
+    bool pop(T& value) {
+        if (tryPop(value)) return true;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        while (true) {
+            sleepers.fetch_add(1, std::memory_order_seq_cst);
+            bool found = tryPop(value);
+            bool pushing = !found && enqueuePosition.load(std::memory_order_seq_cst) !=
+                                     dequeuePosition.load(std::memory_order_relaxed);
+            if (found || pushing || closed) {
+                sleepers.fetch_sub(1, std::memory_order_relaxed);
+                if (found) return true;
+                if (!pushing) return false;
+                // A producer has claimed a cell but not filled it yet
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+                continue;
+            }
+            wakeup.wait(lock);
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Let every sleeping and future pop() return false once the queue is empty
+    void close() {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        closed = true;
+        wakeup.notify_all();
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> enqueuePosition{0}; // Producers and consumers on separate lines
+    alignas(64) std::atomic<size_t> dequeuePosition{0};
+    alignas(64) std::atomic<int> sleepers{0};            // Consumers in (or about to enter) wait()
+    std::mutex sleepMutex;
+    std::condition_variable wakeup;
+    bool closed = false;                                  // Guarded by sleepMutex
+};
+
+#endif // QUEUE_H
@@ -0,0 +1,137 @@
+// record.h 🐧
+//
+// Machine-readable output for ColorDir (--json and -0).
+// Entries are written straight into the output buffer as NDJSON objects or NUL-terminated
+// paths, without colors, emoji, padding or human-readable sizes, so the listing can be fed
+// into other programs (like find -print0 / -printf) at the speed it is scanned.
+//
+//   --json   {"path":"src/c.cpp","type":"programming","size":1234,"mode":33188,"mtime":1716200000}
+//   -0       src/c.cpp\0
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef RECORD_H
+#define RECORD_H
+
+#include <charconv>
+#include <string_view>
+#include "hdir.h"
+
+// Name of the category of an entry, as used in --json output
+std::string_view fileTypeName(const DirEntry& entry) {
+    if (entry.isDirectory) return "directory";
+    switch (entry.type) {
+        case FileType::Programming: return "programming";
+        case FileType::Text: return "text";
+        case FileType::Video: return "video";
+        case FileType::Picture: return "picture";
+        case FileType::Hidden: return "hidden";
+        case FileType::Executable: return "executable";
+        case FileType::Compressed: return "compressed";
+        default: return "other";
+    }
+}
+
+// Length of the valid UTF-8 sequence starting at text[i], or 0 if the bytes there are invalid
+size_t utf8SequenceLength(std::string_view text, size_t i) {
+    unsigned char lead = static_cast<unsigned char>(text[i]);
+    size_t length;
+    std::uint32_t minimum, codePoint;
+    if (lead >= 0xC2 && lead <= 0xDF) { length = 2; minimum = 0x80; codePoint = lead & 0x1F; }
+    else if (lead >= 0xE0 && lead <= 0xEF) { length = 3; minimum = 0x800; codePoint = lead & 0x0F; }
+    else if (lead >= 0xF0 && lead <= 0xF4) { length = 4; minimum = 0x10000; codePoint = lead & 0x07; }
+    else return 0;
+
+    if (i + length > text.size()) return 0;
+    for (size_t k = 1; k < length; ++k) {
+        unsigned char c = static_cast<unsigned char>(text[i + k]);
+        if ((c & 0xC0) != 0x80) return 0;
+        codePoint = (codePoint << 6) | (c & 0x3F);
+    }
+    if (codePoint < minimum || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF)) return 0;
+    return length;
+}
+
+// Append text as the contents of a JSON string literal (without the quotes)
+// Quotes, backslashes and control characters are escaped. File names are only bytes, so a
+// byte that is not part of valid UTF-8 becomes U+FFFD (use -0 where names must be exact).
+void writeJsonChars(OutputWriter& out, std::string_view text) {
+    static const char hex[] = "0123456789abcdef";
+    size_t start = 0; // Start of the run of bytes that can be copied unchanged
+    for (size_t i = 0; i < text.size();) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c < 0x80 && c != '"' && c != '\\') {
+            ++i;
+            continue;
+        }
+        size_t sequence = (c >= 0x80) ? utf8SequenceLength(text, i) : 0;
+        if (sequence > 0) {
+            i += sequence;
+            continue;
+        }
+
+        out.write(text.substr(start, i - start));
+        if (c == '"' || c == '\\') {
+            out.put('\\');
+            out.put(static_cast<char>(c));
+        } else if (c < 0x20) {
+            char escape[6] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+            out.write(escape, sizeof(escape));
+        } else {
+            out.write("\xEF\xBF\xBD"); // U+FFFD replacement character
+        }
+        start = ++i;
+    }
+    out.write(text.substr(start));
+}
+
+// Append an unsigned or signed integer in decimal
+template <typename Integer>
+void writeNumber(OutputWriter& out, Integer value) {
+    char digits[24];
+    auto result = std::to_chars(digits, digits + sizeof(digits), value);
+    out.write(digits, static_cast<size_t>(result.ptr - digits));
+}
+
+// Append parent / name without building an fs::path (same result as the / operator)
+void writeEntryPath(OutputWriter& out, const fs::path& parent, std::string_view name) {
+    const std::string& directory = parent.native();
+    out.write(directory);
+    if (!directory.empty() && directory.back() != '/') out.put('/');
+    out.write(name);
+}
+
+// Print one entry in a machine-readable format
+void printRecord(const DirEntry& entry, const fs::path& parent, OutputFormat format) {
+    OutputWriter& out = output();
+    if (format == OutputFormat::NullSeparated) {
+        writeEntryPath(out, parent, entry.name);
+        out.put('\0');
+        return;
+    }
+
+    // The path goes through the escaper in two parts, so it is never copied
+    const std::string& directory = parent.native();
+    out.write("{\"path\":\"");
+    writeJsonChars(out, directory);
+    if (!directory.empty() && directory.back() != '/') out.put('/');
+    writeJsonChars(out, entry.name);
+    out.write("\",\"type\":\"");
+    out.write(fileTypeName(entry));
+    out.write("\",\"size\":");
+    writeNumber(out, entry.size);
+    if (entry.hasStat) {
+        out.write(",\"mode\":");
+        writeNumber(out, static_cast<unsigned>(entry.mode));
+        out.write(",\"mtime\":");
+        writeNumber(out, static_cast<long long>(entry.mtime));
+    } else {
+        out.write(",\"mode\":null,\"mtime\":null");
+    }
+    out.put('}');
+    out.endLine();
+}
+
+#endif // RECORD_H
@@ -0,0 +1,111 @@
+// render.h 🐧
+//
+// Render templates for ColorDir.
+// Every entry is drawn as a prefix (its emoji and color), the name, and a reset. The prefixes
+// only depend on the file type and on whether the entry is a directory or hidden, so they are
+// concatenated once, at compile time, into a table that the list and the wide view share.
+// A second table holds the same emoji without any escape codes, for --color=never, NO_COLOR
+// and output that doesn't go to a terminal.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef RENDER_H
+#define RENDER_H
+
+#include <cstdint>
+#include <string_view>
+#include "hdir.h"
+
+constexpr size_t fileTypeCount = static_cast<size_t>(FileType::Other) + 1;
+
+// Directories get a style of their own, after the file types; every style has a hidden variant
+constexpr size_t renderStyleCount = (fileTypeCount + 1) * 2;
+
+// Pre-concatenated bytes written in front of a name, in the order each view needs them
+struct RenderTemplate {
+    char listBytes[16] = {};   // List view: emoji, then color
+    std::uint8_t listLength = 0;
+    char wideBytes[16] = {};   // Wide view: color, then emoji
+    std::uint8_t wideLength = 0;
+    std::uint8_t width = 0;    // Terminal columns taken by the emoji and its space
+
+    constexpr std::string_view listPrefix() const { return std::string_view(listBytes, listLength); }
+    constexpr std::string_view widePrefix() const { return std::string_view(wideBytes, wideLength); }
+};
+
+// All templates of one color mode, plus the escapes written after them
+struct RenderTable {
+    RenderTemplate styles[renderStyleCount];
+    std::string_view reset;     // After every entry
+    std::string_view truncated; // Marker for a name cut short in the wide view
+
+    const RenderTemplate& style(FileType type, bool isDirectory, bool isHidden) const {
+        size_t index = isDirectory ? fileTypeCount : static_cast<size_t>(type);
+        return styles[index * 2 + (isHidden ? 1 : 0)];
+    }
+};
+
+// Emoji of a style (index fileTypeCount is the directory style)
+constexpr std::string_view styleEmoji(size_t style) {
+    if (style == fileTypeCount) return "📂 ";
+    switch (static_cast<FileType>(style)) {
+        case FileType::Programming: return "💻 ";
+        case FileType::Text: return "📜 ";
+        case FileType::Video: return "🎬 ";
+        case FileType::Picture: return "🖼️ ";
+        case FileType::Executable: return "⚙️ ";
+        case FileType::Compressed: return "🎁 ";
+        default: return "📄 "; // Other/Unknown files
+    }
+}
+
+// Color of a style
+constexpr std::string_view styleColor(size_t style, bool isHidden) {
+    if (isHidden) return "\033[1;30m";                   // Dark Gray for hidden files/directories
+    if (style == fileTypeCount) return "\033[1;34m";     // Blue for directories
+    switch (static_cast<FileType>(style)) {
+        case FileType::Programming: return "\033[0;36m"; // Cyan
+        case FileType::Text: return "\033[0;32m";        // Green
+        case FileType::Video: return "\033[0;35m";       // Magenta
+        case FileType::Picture: return "\033[0;33m";     // Yellow
+        case FileType::Compressed: return "\033[1;31m";  // Red
+        case FileType::Hidden: return "\033[1;30m";      // Dark Gray
+        case FileType::Executable: return "\033[1;36m";  // Bright Cyan
+        default: return "\033[0m";                       // Default (white)
+    }
+}
+
+constexpr void appendBytes(char* bytes, std::uint8_t& length, std::string_view text) {
+    for (char c : text) bytes[length++] = c;
+}
+
+constexpr RenderTable makeRenderTable(bool color) {
+    RenderTable table;
+    for (size_t style = 0; style <= fileTypeCount; ++style) {
+        for (int hidden = 0; hidden < 2; ++hidden) {
+            RenderTemplate& entry = table.styles[style * 2 + hidden];
+            std::string_view emoji = styleEmoji(style);
+            std::string_view escape = color ? styleColor(style, hidden) : std::string_view();
+            appendBytes(entry.listBytes, entry.listLength, emoji);
+            appendBytes(entry.listBytes, entry.listLength, escape);
+            appendBytes(entry.wideBytes, entry.wideLength, escape);
+            appendBytes(entry.wideBytes, entry.wideLength, emoji);
+            entry.width = 3; // Every emoji is drawn two columns wide, plus the space
+        }
+    }
+    table.reset = color ? "\033[0m" : "";
+    table.truncated = color ? "\033[1;33m>\033[0m" : ">"; // Bright yellow ">"
+    return table;
+}
+
+inline constexpr RenderTable colorRenderTable = makeRenderTable(true);
+inline constexpr RenderTable plainRenderTable = makeRenderTable(false);
+
+// The table for the current color mode (see colorOutput in hdir.h)
+inline const RenderTable& renderTable() {
+    return colorOutput ? colorRenderTable : plainRenderTable;
+}
+
+#endif // RENDER_H
@@ -0,0 +1,120 @@
+// scan.h 🐧
+//
+// Linux-native directory scanner for ColorDir.
+// Directory entries are read in large getdents64 batches into a reusable buffer, and the
+// d_type reported by the filesystem is used to classify them, so most entries never need a
+// stat call of their own.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <vector>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "perf.h"
+
+// Record layout returned by the getdents64 system call (see getdents64(2))
+struct LinuxDirent64 {
+    ino64_t        d_ino;
+    off64_t        d_off;
+    unsigned short d_reclen;
+    unsigned char  d_type;
+    char           d_name[];
+};
+
+// A single raw entry produced by DirectoryScanner
+// The name points into the scanner buffer and is only valid until the next call to next()
+struct ScanEntry {
+    const char* name;      // NUL-terminated file name
+    size_t nameLength;     // Length of the name in bytes
+    unsigned char type;    // DT_* value reported by the filesystem (DT_UNKNOWN if not supported)
+    ino64_t inode;         // Inode number reported by the filesystem
+    off64_t offset;        // Directory position after this entry, usable with seek()
+};
+
+// Reads a directory with getdents64, one large batch at a time
+class DirectoryScanner {
+public:
+    explicit DirectoryScanner(size_t bufferSize = 256 * 1024) : buffer(bufferSize) {}
+    ~DirectoryScanner() { close(); }
+
+    DirectoryScanner(const DirectoryScanner&) = delete;
+    DirectoryScanner& operator=(const DirectoryScanner&) = delete;
+
+    // Open a directory for scanning, returns false if it cannot be opened
+    bool open(const char* path) {
+        close();
+        countEvent(PerfEvent::Open);
+        dirFd = ::open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        return dirFd >= 0;
+    }
+
+    // Fetch the next entry, skipping "." and "..", returns false at the end of the directory
+    bool next(ScanEntry& entry) {
+        while (true) {
+            if (position >= length) {
+                if (dirFd < 0) return false;
+                countEvent(PerfEvent::Getdents);
+                long bytesRead = syscall(SYS_getdents64, dirFd, buffer.data(), buffer.size());
+                if (bytesRead <= 0) return false; // End of directory or read error
+                length = static_cast<size_t>(bytesRead);
+                position = 0;
+            }
+
+            const auto* record = reinterpret_cast<const LinuxDirent64*>(buffer.data() + position);
+            position += record->d_reclen;
+
+            const char* name = record->d_name;
+            if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'))) {
+                continue; // Skip "." and ".."
+            }
+
+            entry.name = name;
+            entry.nameLength = std::strlen(name);
+            entry.type = record->d_type;
+            entry.inode = record->d_ino;
+            entry.offset = record->d_off;
+            return true;
+        }
+    }
+
+    // Continue reading at a position returned in ScanEntry::offset (0 restarts the directory)
+    bool seek(off64_t offset) {
+        position = length = 0;
+        return dirFd >= 0 && lseek64(dirFd, offset, SEEK_SET) == offset;
+    }
+
+    // File descriptor of the open directory, used for *at() calls relative to it
+    int fd() const { return dirFd; }
+
+    // Close the directory, the buffer is kept for the next open()
+    void close() {
+        if (dirFd >= 0) ::close(dirFd);
+        dirFd = -1;
+        position = length = 0;
+    }
+
+private:
+    int dirFd = -1;             // Directory being scanned
+    std::vector<char> buffer;   // Reusable getdents64 buffer
+    size_t position = 0;        // Read position inside the buffer
+    size_t length = 0;          // Number of valid bytes in the buffer
+};
+
+// Fetch the requested statx fields of an entry relative to an open directory
+// (a single metadata call; symlinks are followed unless follow is false)
+bool statEntry(int dirFd, const char* name, unsigned int mask, struct statx& info, bool follow = true) {
+    int flags = AT_NO_AUTOMOUNT | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+    countEvent(PerfEvent::Statx);
+    return statx(dirFd, name, flags, mask, &info) == 0;
+}
+
+#endif // SCAN_H
@@ -0,0 +1,284 @@
+// sniff.h 🐧
+//
+// Content sniffing for ColorDir (--sniff).
+// Files the extension table can't place (build outputs, blobs, scripts without a suffix) are
+// recognized by their first bytes instead: ELF binaries, #! scripts, archives, images, videos
+// and plain text. At most sniffHeaderSize bytes are read per file, plus the five bytes of the
+// ISO 9660 signature for unknown files that are big enough to have one. The files of one
+// directory are read as a batch, split over the metadata helper threads (meta.h) when lookups
+// are overlapped there too, and every result is cached by (device, inode, mtime), so a file
+// that is reached again (a hard link, a --watch update that didn't change it) is not read twice.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef SNIFF_H
+#define SNIFF_H
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <string_view>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "hdir.h"
+#include "meta.h"
+#include "perf.h"
+
+// Bytes read from the start of a file; enough for every signature below ("ustar" at 257)
+constexpr size_t sniffHeaderSize = 512;
+
+// An ISO 9660 image has "CD001" in its first volume descriptor, after 32 KB of system area
+constexpr off_t isoSignatureOffset = 32769;
+
+// A signature: up to two byte strings that must appear at fixed offsets
+struct MagicRule {
+    size_t offset;
+    std::string_view bytes;
+    size_t secondOffset;
+    std::string_view secondBytes; // Empty if one string is enough
+    FileType type;
+};
+
+// Tried in order, so the more specific rules come first (HEIF before other ftyp containers)
+constexpr MagicRule magicRules[] = {
+    // Programs
+    {0, "\x7f" "ELF", 0, {}, FileType::Executable},
+    {0, "MZ", 0, {}, FileType::Executable},
+    {0, "\xcf\xfa\xed\xfe", 0, {}, FileType::Executable}, // Mach-O, 64 bit
+    {0, "\xce\xfa\xed\xfe", 0, {}, FileType::Executable}, // Mach-O, 32 bit
+    {0, "#!", 0, {}, FileType::Programming},
+
+    // Archives and compressed data
+    {0, "\x1f\x8b", 0, {}, FileType::Compressed},                 // gzip
+    {0, "\x28\xb5\x2f\xfd", 0, {}, FileType::Compressed},         // zstd
+    {0, std::string_view("\xfd" "7zXZ\0", 6), 0, {}, FileType::Compressed}, // xz
+    {0, "BZh", 0, {}, FileType::Compressed},                      // bzip2
+    {0, "\x04\x22\x4d\x18", 0, {}, FileType::Compressed},         // lz4
+    {0, "\x1f\x9d", 0, {}, FileType::Compressed},                 // compress
+    {0, "LZIP", 0, {}, FileType::Compressed},
+    {0, "PK\x03\x04", 0, {}, FileType::Compressed},               // zip, jar, apk
+    {0, "PK\x05\x06", 0, {}, FileType::Compressed},               // Empty zip
+    {0, "7z\xbc\xaf\x27\x1c", 0, {}, FileType::Compressed},
+    {0, "Rar!\x1a\x07", 0, {}, FileType::Compressed},
+    {0, "!<arch>\n", 0, {}, FileType::Compressed},                // ar: .deb, static libraries
+    {0, "\xed\xab\xee\xdb", 0, {}, FileType::Compressed},         // rpm
+    {0, "MSCF", 0, {}, FileType::Compressed},                     // cab
+    {0, "hsqs", 0, {}, FileType::Compressed},                     // squashfs
+    {257, "ustar", 0, {}, FileType::Compressed},                  // tar
+
+    // Pictures
+    {0, "\x89PNG\r\n\x1a\n", 0, {}, FileType::Picture},
+    {0, "\xff\xd8\xff", 0, {}, FileType::Picture},                // JPEG
+    {0, "GIF87a", 0, {}, FileType::Picture},
+    {0, "GIF89a", 0, {}, FileType::Picture},
+    {0, std::string_view("II*\0", 4), 0, {}, FileType::Picture},  // TIFF, little endian
+    {0, std::string_view("MM\0*", 4), 0, {}, FileType::Picture},  // TIFF, big endian
+    {0, "RIFF", 8, "WEBP", FileType::Picture},
+    {4, "ftyp", 8, "heic", FileType::Picture},
+    {4, "ftyp", 8, "heix", FileType::Picture},
+    {4, "ftyp", 8, "mif1", FileType::Picture},
+    {4, "ftyp", 8, "avif", FileType::Picture},
+
+    // Videos
+    {4, "ftyp", 0, {}, FileType::Video},                          // MP4, MOV, 3GP
+    {0, "RIFF", 8, "AVI ", FileType::Video},
+    {0, "\x1a\x45\xdf\xa3", 0, {}, FileType::Video},              // Matroska, WebM
+    {0, "OggS", 0, {}, FileType::Video},
+    {0, "FLV\x01", 0, {}, FileType::Video},
+    {0, std::string_view("\0\0\x01\xba", 4), 0, {}, FileType::Video}, // MPEG program stream
+    {0, "\x30\x26\xb2\x75\x8e\x66\xcf\x11", 0, {}, FileType::Video},  // ASF, WMV
+
+    // Documents
+    {0, "%PDF-", 0, {}, FileType::Text},
+};
+
+// True if the header has bytes at the given offset
+inline bool headerHas(const unsigned char* header, size_t length, size_t offset, std::string_view bytes) {
+    return offset + bytes.size() <= length && std::memcmp(header + offset, bytes.data(), bytes.size()) == 0;
+}
+
+// True if the header looks like text: valid UTF-8 without NUL or control characters other than
+// the usual whitespace (and ESC, for logs with colors). A sequence cut off at the end of a
+// full header counts as valid, since the rest of it is just not read.
+inline bool looksLikeText(const unsigned char* header, size_t length, bool truncated) {
+    for (size_t i = 0; i < length;) {
+        unsigned char c = header[i];
+        if (c < 0x80) {
+            if ((c < 0x20 && c != '\t' && c != '\n' && c != '\r' && c != '\f' && c != '\v' && c != 0x1b) || c == 0x7f) {
+                return false;
+            }
+            ++i;
+            continue;
+        }
+        size_t extra = (c & 0xe0) == 0xc0 ? 1 : (c & 0xf0) == 0xe0 ? 2 : (c & 0xf8) == 0xf0 ? 3 : 0;
+        if (extra == 0 || c == 0xc0 || c == 0xc1 || c > 0xf4) return false;
+        if (i + extra >= length) return truncated;
+        for (size_t k = 1; k <= extra; ++k) {
+            if ((header[i + k] & 0xc0) != 0x80) return false;
+        }
+        i += extra + 1;
+    }
+    return length > 0;
+}
+
+// Category of a file from its first bytes, Other if nothing matches
+// truncated: the header is only part of the file (so text may be cut off anywhere)
+inline FileType classifyHeader(const unsigned char* header, size_t length, bool truncated) {
+    for (const MagicRule& rule : magicRules) {
+        if (!headerHas(header, length, rule.offset, rule.bytes)) continue;
+        if (!rule.secondBytes.empty() && !headerHas(header, length, rule.secondOffset, rule.secondBytes)) continue;
+        return rule.type;
+    }
+    return looksLikeText(header, length, truncated) ? FileType::Text : FileType::Other;
+}
+
+// Read the header of a file in dirFd and classify it
+// The file is opened without updating its access time where the owner allows it
+inline FileType sniffFile(int dirFd, const char* name, std::uintmax_t size) {
+    const int flags = O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC;
+    int fd = openat(dirFd, name, flags | O_NOATIME);
+    if (fd < 0 && errno == EPERM) fd = openat(dirFd, name, flags);
+    if (fd < 0) return FileType::Other;
+    countEvent(PerfEvent::HeaderRead);
+
+    auto readAt = [fd](unsigned char* buffer, size_t length, off_t offset) {
+        ssize_t result;
+        while ((result = pread(fd, buffer, length, offset)) < 0 && errno == EINTR) {
+        }
+        return result < 0 ? size_t(0) : static_cast<size_t>(result);
+    };
+    unsigned char header[sniffHeaderSize];
+    size_t length = readAt(header, sizeof(header), 0);
+    FileType type = classifyHeader(header, length, length == sizeof(header));
+    if (type == FileType::Other && size >= static_cast<std::uintmax_t>(isoSignatureOffset) + 5) {
+        unsigned char signature[5];
+        if (readAt(signature, sizeof(signature), isoSignatureOffset) == sizeof(signature) &&
+            std::memcmp(signature, "CD001", 5) == 0) {
+            type = FileType::Compressed; // Disc images are listed with the archives, like .iso
+        }
+    }
+    ::close(fd);
+    return type;
+}
+
+// Identity of one version of a file
+struct SniffKey {
+    std::uint64_t device = 0;
+    std::uint64_t inode = 0;    // 0: unknown, the result is not cached
+    std::int64_t mtimeSeconds = 0;
+    std::uint32_t mtimeNanoseconds = 0;
+
+    bool operator==(const SniffKey& other) const {
+        return device == other.device && inode == other.inode && mtimeSeconds == other.mtimeSeconds &&
+               mtimeNanoseconds == other.mtimeNanoseconds;
+    }
+};
+
+// The key of the file a statx described (it must have asked for STATX_INO and STATX_MTIME)
+inline SniffKey sniffKey(const struct statx& info) {
+    SniffKey key;
+    if ((info.stx_mask & (STATX_INO | STATX_MTIME)) != (STATX_INO | STATX_MTIME)) return key;
+    key.device = makedev(info.stx_dev_major, info.stx_dev_minor);
+    key.inode = info.stx_ino;
+    key.mtimeSeconds = info.stx_mtime.tv_sec;
+    key.mtimeNanoseconds = info.stx_mtime.tv_nsec;
+    return key;
+}
+
+struct SniffKeyHash {
+    size_t operator()(const SniffKey& key) const {
+        std::uint64_t hash = key.inode * 0x9e3779b97f4a7c15ull;
+        hash ^= (key.device + static_cast<std::uint64_t>(key.mtimeSeconds)) * 0xc2b2ae3d27d4eb4full;
+        hash ^= key.mtimeNanoseconds;
+        return static_cast<size_t>(hash ^ (hash >> 29));
+    }
+};
+
+// Results of earlier reads, shared by all threads
+// The cache is split into shards with a lock each, so workers of a recursive listing rarely
+// wait for each other; a full shard starts over, which keeps the memory bounded
+class SniffCache {
+public:
+    static SniffCache& instance() {
+        static SniffCache cache;
+        return cache;
+    }
+
+    bool find(const SniffKey& key, FileType& type) {
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.types.find(key);
+        if (found == shard.types.end()) return false;
+        type = found->second;
+        return true;
+    }
+
+    void store(const SniffKey& key, FileType type) {
+        Shard& shard = shardOf(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (shard.types.size() >= shardCapacity) shard.types.clear();
+        shard.types[key] = type;
+    }
+
+private:
+    static constexpr size_t shardCount = 16;
+    static constexpr size_t shardCapacity = 4096; // Results kept per shard
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<SniffKey, FileType, SniffKeyHash> types;
+    };
+
+    Shard& shardOf(const SniffKey& key) { return shards[(SniffKeyHash()(key) >> 7) % shardCount]; }
+
+    Shard shards[shardCount];
+};
+
+// One file of a batch
+struct SniffRequest {
+    const char* name = nullptr;      // NUL-terminated, relative to the directory of the batch
+    std::uintmax_t size = 0;
+    SniffKey key;
+    std::uint32_t tag = 0;           // E.g. the index of the entry, for matching the result up
+    FileType type = FileType::Other; // Result
+};
+
+// Classify requests[0..count), all in dirFd: cached results first, then the headers of the
+// rest, read on the calling thread or split over the helpers like the statx batches (meta.h)
+inline void sniffFiles(int dirFd, SniffRequest* requests, size_t count) {
+    if (count == 0) return;
+    PhaseScope phase(Phase::Sniff);
+    SniffCache& cache = SniffCache::instance();
+    static thread_local std::vector<SniffRequest*> misses;
+    misses.clear();
+    for (size_t i = 0; i < count; ++i) {
+        SniffRequest& request = requests[i];
+        if (request.key.inode == 0 || !cache.find(request.key, request.type)) misses.push_back(&request);
+    }
+    if (misses.empty()) return;
+
+    SniffRequest** pending = misses.data();
+    auto readSlice = [dirFd, pending](size_t first, size_t length) {
+        for (size_t i = first; i < first + length; ++i) {
+            pending[i]->type = sniffFile(dirFd, pending[i]->name, pending[i]->size);
+        }
+    };
+    unsigned depth = metadataQueueDepth.load(std::memory_order_relaxed);
+    if (misses.size() < 16 || runsSerially(dirFd, misses.size(), depth)) {
+        readSlice(0, misses.size());
+    } else {
+        StatHelpers::instance(depth).forEachSlice(misses.size(), readSlice);
+    }
+
+    for (SniffRequest* request : misses) {
+        if (request->key.inode != 0) cache.store(request->key, request->type);
+    }
+}
+
+#endif // SNIFF_H
@@ -0,0 +1,413 @@
+// sort.h 🐧
+//
+// Sorting of directory listings for ColorDir.
+// Every name is case-folded once into a contiguous key arena. The sort then works on small
+// key records (category, numeric key, packed 8-byte prefix, arena offset) instead of DirEntry
+// objects, so comparing two entries is usually one integer compare and never allocates.
+// Only as much is sorted as will be shown: a window of the first entries is selected and
+// sorted on its own (--head, the first screen with -p), and large listings sorted by size or
+// mtime are radix sorted on their numeric keys.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef SORT_H
+#define SORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include "hdir.h"
+#include "perf.h"
+
+// Listings with at least this many entries are categorized, keyed and sorted on several threads
+constexpr size_t parallelSortThreshold = 65536;
+
+// Split [0, count) into at most threads chunks and call body(chunk, first, last) for each of
+// them, every chunk on its own thread (the first one on the calling thread)
+// Helper threads charge their time to the given phase.
+template <typename Body>
+void forEachChunk(size_t count, unsigned threads, Phase phase, Body body) {
+    size_t chunks = std::max<size_t>(1, std::min<size_t>(threads, count));
+    if (chunks == 1) {
+        body(size_t(0), size_t(0), count);
+        return;
+    }
+    std::vector<std::thread> helpers;
+    helpers.reserve(chunks - 1);
+    for (size_t chunk = 1; chunk < chunks; ++chunk) {
+        helpers.emplace_back([&body, phase, chunk, chunks, count] {
+            PhaseScope scope(phase);
+            body(chunk, chunk * count / chunks, (chunk + 1) * count / chunks);
+        });
+    }
+    body(size_t(0), size_t(0), count / chunks);
+    for (auto& helper : helpers) helper.join();
+}
+
+// Lowercase an ASCII character (same result as ::tolower in the "C" locale)
+inline unsigned char foldCase(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+}
+
+// Case-folded sort keys of one listing, stored back to back
+class CollationKeys {
+public:
+    // One record per entry; this is what actually gets sorted
+    struct Key {
+        std::uint64_t number;   // Numeric key (--sort=size / mtime), compared before the name
+        std::uint64_t prefix;   // First 8 folded bytes, big-endian, zero padded
+        std::uint32_t offset;   // Start of the folded name in the arena
+        std::uint32_t length;   // Length of the folded name
+        std::uint32_t index;    // Position of the entry in the unsorted list
+        std::uint8_t group;     // Primary sort group (0 for directories), compared first
+    };
+
+    // Forget all keys but keep the allocated memory for the next listing
+    void clear() {
+        arena.clear();
+        keys.clear();
+    }
+
+    // Bytes of folded text a key takes in the arena
+    static size_t textLength(std::string_view name, const std::string_view* extension = nullptr) {
+        return name.size() + (extension ? extension->size() + 1 : 0);
+    }
+
+    // Fold a name into the arena and add its key record
+    void add(std::string_view name, std::uint8_t group, std::uint64_t number = 0,
+             const std::string_view* extension = nullptr) {
+        size_t offset = arena.size();
+        arena.resize(offset + textLength(name, extension));
+        keys.emplace_back();
+        set(keys.size() - 1, offset, name, group, number, extension);
+    }
+
+    // Make room for count keys with textBytes of folded text in total, to be filled in with set()
+    // (by several threads at once, each one on its own keys and part of the arena)
+    void resize(size_t count, size_t textBytes) {
+        keys.resize(count);
+        arena.resize(textBytes);
+    }
+
+    // Fill in key i, folding its text into the arena at offset
+    // With an extension, the folded text is the extension, a NUL, then the name, so entries
+    // are ordered by extension first (a name can't contain NUL, so the extension always ends there)
+    void set(size_t i, size_t offset, std::string_view name, std::uint8_t group, std::uint64_t number = 0,
+             const std::string_view* extension = nullptr) {
+        Key& key = keys[i];
+        key.number = number;
+        key.offset = static_cast<std::uint32_t>(offset);
+        key.length = static_cast<std::uint32_t>(textLength(name, extension));
+        key.index = static_cast<std::uint32_t>(i);
+        key.group = group;
+        key.prefix = 0;
+
+        unsigned char* folded = arena.data() + offset;
+        if (extension) {
+            folded = fold(folded, *extension);
+            *folded++ = 0;
+        }
+        fold(folded, name);
+        folded = arena.data() + offset;
+        for (size_t b = 0; b < 8; ++b) {
+            key.prefix = (key.prefix << 8) | (b < key.length ? folded[b] : 0);
+        }
+    }
+
+    // Strict total ordering: group, number, then folded text (bytewise, like std::string), and
+    // for names that only differ in case, the position in the unsorted list
+    // As no two keys are equal, every way of sorting them gives exactly the same order.
+    bool less(const Key& a, const Key& b) const {
+        if (a.group != b.group) return a.group < b.group;
+        if (a.number != b.number) return a.number < b.number;
+        if (a.prefix != b.prefix) return a.prefix < b.prefix;
+        // Equal prefixes: the first 8 bytes are equal, or the shorter text ends within them
+        if (a.length > 8 && b.length > 8) {
+            std::uint32_t common = std::min(a.length, b.length) - 8;
+            int result = std::memcmp(arena.data() + a.offset + 8, arena.data() + b.offset + 8, common);
+            if (result != 0) return result < 0;
+        }
+        if (a.length != b.length) return a.length < b.length;
+        return a.index < b.index;
+    }
+
+    // Put the records of group 0 (the directories) first, keeping the order within both parts
+    // Returns the number of group 0 records
+    size_t partition() {
+        scratch.clear();
+        size_t front = 0;
+        for (const Key& key : keys) {
+            if (key.group == 0) {
+                keys[front++] = key;
+            } else {
+                scratch.push_back(key);
+            }
+        }
+        std::copy(scratch.begin(), scratch.end(), keys.begin() + static_cast<std::ptrdiff_t>(front));
+        return front;
+    }
+
+    // Sort the records [first, last) so that at least the first window of them are in order
+    // A window smaller than the range only pays for selecting and sorting that window
+    // (nth_element + sort); a complete sort of many records with numeric keys goes through
+    // a radix sort of the numbers first. A complete sort of a huge range is split over up to
+    // threads threads.
+    void sort(size_t first, size_t last, size_t window = SIZE_MAX, unsigned threads = 1) {
+        auto compare = [this](const Key& a, const Key& b) { return less(a, b); };
+        auto begin = keys.begin() + static_cast<std::ptrdiff_t>(first);
+        auto end = keys.begin() + static_cast<std::ptrdiff_t>(last);
+        size_t count = last - first;
+        if (window == 0 || count < 2) return;
+        if (window >= count && threads > 1 && count >= parallelSortThreshold) {
+            parallelSort(first, last, threads);
+        } else if (window < count) {
+            auto middle = begin + static_cast<std::ptrdiff_t>(window);
+            std::nth_element(begin, middle, end, compare);
+            std::sort(begin, middle, compare);
+        } else if (count >= radixThreshold && hasNumbers(first, last)) {
+            radixSort(first, last);
+            // Equal numbers (and groups) are left in their original order: sort those runs by name
+            for (auto run = begin; run != end;) {
+                auto next = run + 1;
+                while (next != end && next->number == run->number && next->group == run->group) ++next;
+                if (next - run > 1) std::sort(run, next, compare);
+                run = next;
+            }
+        } else {
+            std::sort(begin, end, compare);
+        }
+    }
+
+    const std::vector<Key>& sorted() const { return keys; }
+
+private:
+    // Below this many records std::sort is as fast as the radix passes
+    static constexpr size_t radixThreshold = 4096;
+
+    // Fold text into the arena, returns the end of the folded copy
+    static unsigned char* fold(unsigned char* folded, std::string_view text) {
+        for (size_t i = 0; i < text.size(); ++i) {
+            folded[i] = foldCase(static_cast<unsigned char>(text[i]));
+        }
+        return folded + text.size();
+    }
+
+    // Merge sort on several threads: every thread sorts one chunk (like sort() would), then the
+    // sorted chunks are merged pairwise, the merges of each round side by side
+    void parallelSort(size_t first, size_t last, unsigned threads) {
+        size_t chunks = 1;
+        while (chunks * 2 <= threads) chunks *= 2;
+        size_t count = last - first;
+        std::vector<size_t> bounds(chunks + 1);
+        for (size_t c = 0; c <= chunks; ++c) bounds[c] = first + c * count / chunks;
+
+        if (scratch.size() < keys.size()) scratch.resize(keys.size()); // Shared by the radix passes
+        forEachChunk(chunks, static_cast<unsigned>(chunks), Phase::Sort, [&](size_t c, size_t, size_t) {
+            sort(bounds[c], bounds[c + 1]);
+        });
+
+        auto compare = [this](const Key& a, const Key& b) { return less(a, b); };
+        Key* from = keys.data();
+        Key* to = scratch.data();
+        for (size_t width = 1; width < chunks; width *= 2) {
+            size_t pairs = chunks / (width * 2);
+            forEachChunk(pairs, static_cast<unsigned>(pairs), Phase::Sort, [&](size_t pair, size_t, size_t) {
+                size_t low = bounds[pair * width * 2];
+                size_t middle = bounds[pair * width * 2 + width];
+                size_t high = bounds[(pair + 1) * width * 2];
+                std::merge(from + low, from + middle, from + middle, from + high, to + low, compare);
+            });
+            std::swap(from, to);
+        }
+        if (from != keys.data()) {
+            forEachChunk(count, threads, Phase::Sort, [&](size_t, size_t begin, size_t end) {
+                std::copy(from + first + begin, from + first + end, keys.data() + first + begin);
+            });
+        }
+    }
+
+    bool hasNumbers(size_t first, size_t last) const {
+        for (size_t i = first; i < last; ++i) {
+            if (keys[i].number != keys[first].number) return true;
+        }
+        return false;
+    }
+
+    // Stable LSD radix sort of [first, last) by group, then number, one byte per pass
+    // A byte that is the same in every record needs no pass, so small numbers only cost a few
+    void radixSort(size_t first, size_t last) {
+        constexpr size_t passes = 9; // 8 bytes of the number, then the group
+        size_t count = last - first;
+        static thread_local std::vector<std::uint32_t> histograms;
+        histograms.assign(passes * 256, 0);
+        for (size_t i = first; i < last; ++i) {
+            for (size_t pass = 0; pass < 8; ++pass) histograms[pass * 256 + ((keys[i].number >> (pass * 8)) & 0xff)]++;
+            histograms[8 * 256 + keys[i].group]++;
+        }
+
+        if (scratch.size() < last) scratch.resize(last);
+        Key* from = keys.data() + first;
+        Key* to = scratch.data() + first; // Only this part, other threads may sort other parts
+        for (size_t pass = 0; pass < passes; ++pass) {
+            std::uint32_t* histogram = &histograms[pass * 256];
+            auto digit = [pass](const Key& key) -> size_t {
+                return pass < 8 ? (key.number >> (pass * 8)) & 0xff : key.group;
+            };
+            if (histogram[digit(*from)] == count) continue; // Every record has this byte
+
+            std::uint32_t offset = 0;
+            for (size_t b = 0; b < 256; ++b) {
+                std::uint32_t bucket = histogram[b];
+                histogram[b] = offset;
+                offset += bucket;
+            }
+            for (size_t i = 0; i < count; ++i) to[histogram[digit(from[i])]++] = from[i];
+            std::swap(from, to);
+        }
+        if (from != keys.data() + first) std::copy(from, from + count, keys.data() + first);
+    }
+
+    std::vector<unsigned char> arena; // Folded names, back to back
+    std::vector<Key> keys;            // One record per entry
+    std::vector<Key> scratch;         // Second buffer for partitioning, merging and radix passes
+};
+
+// Extension of a name for --sort=ext, like path::extension: from its last dot, unless that
+// is the first character (a hidden file); empty if there is none
+inline std::string_view sortExtension(std::string_view name) {
+    size_t dot = name.rfind('.');
+    if (dot == std::string_view::npos || dot == 0) return {};
+    return name.substr(dot);
+}
+
+// Sort key of a time: later times first
+inline std::uint64_t newestFirst(time_t time) {
+    return ~(static_cast<std::uint64_t>(time) ^ (std::uint64_t(1) << 63));
+}
+
+// What the sort key of an entry is made of: its group, numeric key and (for --sort=ext) extension
+struct SortKeyParts {
+    std::uint8_t group = 0;
+    std::uint64_t number = 0;
+    std::string_view extension;
+    bool byExtension = false;
+};
+
+SortKeyParts sortKeyParts(const DirEntry& entry, SortOrder order) {
+    SortKeyParts key;
+    key.group = entry.isDirectory ? 0 : 1;
+    switch (order) {
+        case SortOrder::Type:
+            if (!entry.isDirectory) key.group = 1 + static_cast<std::uint8_t>(entry.type);
+            break;
+        case SortOrder::Size: key.number = ~static_cast<std::uint64_t>(entry.size); break; // Largest first
+        case SortOrder::Mtime: key.number = newestFirst(entry.mtime); break;
+        case SortOrder::Extension:
+            key.extension = sortExtension(entry.name);
+            key.byExtension = true;
+            break;
+        default: break; // Name, and None (which only needs the groups)
+    }
+    return key;
+}
+
+// The folded text that CollationKeys compares for an entry, as a string of its own
+// (for listings kept in order one change at a time, see the --watch listing)
+std::string sortText(std::string_view name, const SortKeyParts& key) {
+    std::string text;
+    text.reserve(CollationKeys::textLength(name, key.byExtension ? &key.extension : nullptr));
+    auto append = [&text](std::string_view part) {
+        for (char c : part) text.push_back(static_cast<char>(foldCase(static_cast<unsigned char>(c))));
+    };
+    if (key.byExtension) {
+        append(key.extension);
+        text.push_back('\0');
+    }
+    append(name);
+    return text;
+}
+
+// Sort entries[0..count) of a listing: the directories first, then the files, each part in
+// the given order (see SortOrder)
+// With a window, only the first window entries are guaranteed to be in order; the others still
+// have the directories in front of the files, so they can be sorted later the same way.
+// Huge listings are keyed, sorted and put in order on up to threads threads, in chunks; the
+// result is the same as with one thread.
+void sortEntries(DirEntry* entries, size_t count, SortOrder order, size_t window = SIZE_MAX, unsigned threads = 1) {
+    // References, so that the chunks on other threads use the buffers of this one
+    static thread_local CollationKeys threadKeys;
+    static thread_local std::vector<DirEntry> threadSorted;
+    static thread_local std::vector<size_t> threadChunkOffsets;
+    CollationKeys& keys = threadKeys;
+    std::vector<DirEntry>& sorted = threadSorted;
+    std::vector<size_t>& chunkOffsets = threadChunkOffsets;
+    if (count < parallelSortThreshold) threads = 1;
+    PhaseScope phase(Phase::Sort); // Once per call; the helper threads of forEachChunk charge their own
+
+    auto parts = [order](const DirEntry& entry) { return sortKeyParts(entry, order); };
+
+    keys.clear();
+    if (threads == 1) {
+        for (size_t i = 0; i < count; ++i) {
+            SortKeyParts key = parts(entries[i]);
+            keys.add(entries[i].name, key.group, key.number, key.byExtension ? &key.extension : nullptr);
+        }
+    } else {
+        // First the size of the folded text of every chunk, then every chunk folds its own part
+        size_t chunks = std::min<size_t>(threads, count);
+        chunkOffsets.assign(chunks + 1, 0);
+        forEachChunk(count, threads, Phase::Sort, [&](size_t chunk, size_t first, size_t last) {
+            size_t bytes = 0;
+            for (size_t i = first; i < last; ++i) {
+                SortKeyParts key = parts(entries[i]);
+                bytes += CollationKeys::textLength(entries[i].name, key.byExtension ? &key.extension : nullptr);
+            }
+            chunkOffsets[chunk + 1] = bytes;
+        });
+        for (size_t chunk = 0; chunk < chunks; ++chunk) chunkOffsets[chunk + 1] += chunkOffsets[chunk];
+        keys.resize(count, chunkOffsets[chunks]);
+        forEachChunk(count, threads, Phase::Sort, [&](size_t chunk, size_t first, size_t last) {
+            size_t offset = chunkOffsets[chunk];
+            for (size_t i = first; i < last; ++i) {
+                SortKeyParts key = parts(entries[i]);
+                const std::string_view* extension = key.byExtension ? &key.extension : nullptr;
+                keys.set(i, offset, entries[i].name, key.group, key.number, extension);
+                offset += CollationKeys::textLength(entries[i].name, extension);
+            }
+        });
+    }
+
+    if (order != SortOrder::None && window >= count) {
+        keys.sort(0, count, SIZE_MAX, threads); // The groups already put the directories first
+    } else {
+        size_t directories = keys.partition();
+        if (order != SortOrder::None) {
+            keys.sort(0, directories, window, threads);
+            keys.sort(directories, count, window > directories ? window - directories : 0, threads);
+        }
+    }
+
+    // Put the entries into sorted order (they are small records, the names stay in the arena)
+    sorted.resize(count);
+    const auto& sortedKeys = keys.sorted();
+    forEachChunk(count, threads, Phase::Sort, [&](size_t, size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) sorted[i] = entries[sortedKeys[i].index];
+    });
+    forEachChunk(count, threads, Phase::Sort, [&](size_t, size_t first, size_t last) {
+        std::copy(sorted.begin() + static_cast<std::ptrdiff_t>(first), sorted.begin() + static_cast<std::ptrdiff_t>(last),
+                  entries + first);
+    });
+}
+
+// Sort a whole listing in the default order: directories first, alphabetically
+// (case-insensitive), then files by category and alphabetically within each category
+void sortEntries(std::vector<DirEntry>& entries) {
+    sortEntries(entries.data(), entries.size(), SortOrder::Type);
+}
+
+#endif // SORT_H
@@ -0,0 +1,82 @@
+// stats.h 🐧
+//
+// Run statistics for ColorDir (--stats).
+// Shows where a listing spent its time and what it asked of the system: wall and CPU time
+// per phase, the counted system calls and allocations, and the peak memory use. The report
+// goes to stderr, so it never mixes with the listing itself (or with --json / -0 output).
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+#include "perf.h"
+
+// Everything --stats needs to remember from the start of the run
+class RunStats {
+public:
+    // Start counting events and timing phases
+    void start() {
+        setPerfCounting(true);
+        phaseTimingEnabled.store(true, std::memory_order_relaxed);
+        begin = takePerfSnapshot();
+        startTime = std::chrono::steady_clock::now();
+    }
+
+    // Stop counting and print the report (all worker threads must have finished)
+    void report() {
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+        phaseClock().handOver();
+        phaseTimingEnabled.store(false, std::memory_order_relaxed);
+        PerfSnapshot events = takePerfSnapshot() - begin;
+        setPerfCounting(false);
+
+        static const char* phaseNames[phaseCount] = {
+            "other/idle", "scan", "stat", "categorize", "sniff", "sort", "dir totals", "render", "write", "summary",
+        };
+        PhaseTimes times;
+        {
+            std::lock_guard<std::mutex> lock(finishedPhaseMutex);
+            times = finishedPhaseTimes;
+        }
+
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+        auto milliseconds = [](const struct timeval& time) { return time.tv_sec * 1000.0 + time.tv_usec / 1000.0; };
+
+        std::ostream& out = std::cerr;
+        out << std::endl << "Stats (phase times are summed over all threads):" << std::endl;
+        out << "  " << std::left << std::setw(12) << "phase" << std::right << std::setw(12) << "wall ms"
+            << std::setw(12) << "cpu ms" << std::endl;
+        out << std::fixed << std::setprecision(2);
+        for (size_t i = 0; i < phaseCount; ++i) {
+            if (times.wall[i] == 0 && times.cpu[i] == 0) continue;
+            out << "  " << std::left << std::setw(12) << phaseNames[i] << std::right
+                << std::setw(12) << times.wall[i] / 1e6 << std::setw(12) << times.cpu[i] / 1e6 << std::endl;
+        }
+        out << "  Elapsed: " << elapsed << " ms | CPU: " << milliseconds(usage.ru_utime) << " ms user, "
+            << milliseconds(usage.ru_stime) << " ms system | Peak RSS: " << usage.ru_maxrss << " KB" << std::endl;
+        out << "  Directories opened: " << events[PerfEvent::Open]
+            << " | getdents calls: " << events[PerfEvent::Getdents]
+            << " | stat calls: " << events[PerfEvent::Statx]
+            << " (io_uring submits: " << events[PerfEvent::UringEnter] << ")"
+            << " | Entries sorted: " << events[PerfEvent::SortedEntries];
+        if (events[PerfEvent::HeaderRead] > 0) out << " | Headers read: " << events[PerfEvent::HeaderRead];
+        out << std::endl;
+        out << "  Bytes written: " << events[PerfEvent::WrittenBytes] << " in " << events[PerfEvent::Write]
+            << " writes | Allocations: " << events[PerfEvent::Allocation]
+            << " (" << events[PerfEvent::AllocatedBytes] << " bytes)" << std::endl;
+    }
+
+private:
+    PerfSnapshot begin;
+    std::chrono::steady_clock::time_point startTime;
+};
+
+#endif // STATS_H
@@ -0,0 +1,98 @@
+// top.h 🐧
+//
+// Largest files and directories for ColorDir (--top N).
+// The tree is walked once by the -t size aggregation, and every file size and finished
+// directory total is offered to a bounded min-heap that keeps the N largest seen so far.
+// The smallest kept entry sits on top of the heap, so most offers are rejected by a single
+// compare, before a path is ever built. Memory stays O(N) per worker, whatever the size of
+// the tree; the heaps of all workers are merged once the walk is done.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef TOP_H
+#define TOP_H
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+// A file or directory kept by a TopList
+struct TopItem {
+    std::uintmax_t size = 0; // File size, or the subtree total of a directory
+    std::string path;
+    mode_t mode = 0;         // File type and permission bits (0 if unknown)
+};
+
+// The limit largest items offered to it, ties broken by path so the result doesn't depend on
+// the order of the offers (or on which worker made them)
+class TopList {
+public:
+    explicit TopList(size_t limit = 0) : limit(limit) {}
+
+    // Number of items kept at most
+    size_t capacity() const { return limit; }
+
+    // Cheap test before an item is built: could an item of this size still get in?
+    bool wants(std::uintmax_t size) const {
+        if (heap.size() < limit) return true;
+        return limit > 0 && size >= heap.front().size;
+    }
+
+    void offer(TopItem item) {
+        if (heap.size() < limit) {
+            heap.push_back(std::move(item));
+            std::push_heap(heap.begin(), heap.end(), ranksBefore);
+        } else if (limit > 0 && ranksBefore(item, heap.front())) {
+            std::pop_heap(heap.begin(), heap.end(), ranksBefore);
+            heap.back() = std::move(item);
+            std::push_heap(heap.begin(), heap.end(), ranksBefore);
+        }
+    }
+
+    // Offer every item of another list
+    void merge(TopList& other) {
+        for (auto& item : other.heap) offer(std::move(item));
+        other.heap.clear();
+    }
+
+    // Largest first; the list is empty afterwards
+    std::vector<TopItem> take() {
+        std::sort_heap(heap.begin(), heap.end(), ranksBefore);
+        std::vector<TopItem> items = std::move(heap);
+        heap.clear();
+        return items;
+    }
+
+private:
+    // Larger first, then by path; the worst kept item ends up on top of the heap
+    static bool ranksBefore(const TopItem& a, const TopItem& b) {
+        if (a.size != b.size) return a.size > b.size;
+        return a.path < b.path;
+    }
+
+    size_t limit;
+    std::vector<TopItem> heap;
+};
+
+// What one worker has seen of the tree
+struct TopSizes {
+    explicit TopSizes(size_t limit = 0) : files(limit), directories(limit) {}
+
+    TopList files;
+    TopList directories;
+    int fileCount = 0;       // Every file of the tree, for the summary
+    int directoryCount = 0;  // Every directory below the listed one
+
+    void merge(TopSizes& other) {
+        files.merge(other.files);
+        directories.merge(other.directories);
+        fileCount += other.fileCount;
+        directoryCount += other.directoryCount;
+    }
+};
+
+#endif // TOP_H
@@ -0,0 +1,91 @@
+// watch.h 🐧
+//
+// Change notification for ColorDir (--watch).
+// One inotify watch on the listed directory. Its events are read in batches and reduced to
+// the names of the entries that changed (created, deleted, renamed, written to or with new
+// attributes), so the listing only has to look at those again: the work per update depends
+// on how much changed, not on how big the directory is.
+//
+// Author: CurveZero
+// Version: 0.3 (Beta)
+//
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+class DirectoryWatch {
+public:
+    DirectoryWatch() = default;
+    ~DirectoryWatch() { close(); }
+
+    DirectoryWatch(const DirectoryWatch&) = delete;
+    DirectoryWatch& operator=(const DirectoryWatch&) = delete;
+
+    // Start watching a directory, returns false if inotify is not available for it
+    bool open(const char* path) {
+        notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (notifyFd < 0) return false;
+        const std::uint32_t events = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY |
+                                     IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+        if (inotify_add_watch(notifyFd, path, events) < 0) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (notifyFd >= 0) ::close(notifyFd);
+        notifyFd = -1;
+    }
+
+    // Descriptor to poll for events
+    int fd() const { return notifyFd; }
+
+    // Wait up to timeout milliseconds for events, returns true if there are some
+    bool wait(int timeout) const {
+        struct pollfd pending = {notifyFd, POLLIN, 0};
+        return poll(&pending, 1, timeout) > 0;
+    }
+
+    // What a call to read() found besides changed names
+    struct Result {
+        bool overflow = false; // Events were lost: everything has to be looked at again
+        bool gone = false;     // The directory itself was deleted or moved away
+    };
+
+    // Read all pending events, calling changed(name) for every entry an event was about
+    // (a name can come up more than once)
+    template <typename Changed>
+    Result read(Changed changed) {
+        Result result;
+        while (true) {
+            ssize_t length = ::read(notifyFd, buffer, sizeof(buffer));
+            if (length < 0 && errno == EINTR) continue;
+            if (length <= 0) break; // EAGAIN: nothing left
+            for (ssize_t offset = 0; offset < length;) {
+                const auto* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+                if (event->mask & IN_Q_OVERFLOW) result.overflow = true;
+                if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) result.gone = true;
+                if (event->len > 0) changed(event->name);
+                offset += static_cast<ssize_t>(sizeof(struct inotify_event) + event->len);
+            }
+        }
+        return result;
+    }
+
+private:
+    int notifyFd = -1;
+    alignas(struct inotify_event) char buffer[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+};
+
+#endif // WATCH_H